@@ -26,44 +26,40 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
 #include <netdb.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#endif
 
 #include <rdma/fi_errno.h>
 #include <rdma/fi_endpoint.h>
+#include <rdma/fi_cm.h>
 
 #include <shared.h>
 
-struct test_size_param test_size[] = {
-	{ 1 <<  1, 1 }, { (1 <<  1) + (1 <<  0), 2},
-	{ 1 <<  2, 2 }, { (1 <<  2) + (1 <<  1), 2},
-	{ 1 <<  3, 1 }, { (1 <<  3) + (1 <<  2), 2},
-	{ 1 <<  4, 2 }, { (1 <<  4) + (1 <<  3), 2},
-	{ 1 <<  5, 1 }, { (1 <<  5) + (1 <<  4), 2},
-	{ 1 <<  6, 0 }, { (1 <<  6) + (1 <<  5), 0},
-	{ 1 <<  7, 1 }, { (1 <<  7) + (1 <<  6), 0},
-	{ 1 <<  8, 1 }, { (1 <<  8) + (1 <<  7), 1},
-	{ 1 <<  9, 1 }, { (1 <<  9) + (1 <<  8), 1},
-	{ 1 << 10, 1 }, { (1 << 10) + (1 <<  9), 1},
-	{ 1 << 11, 1 }, { (1 << 11) + (1 << 10), 1},
-	{ 1 << 12, 0 }, { (1 << 12) + (1 << 11), 1},
-	{ 1 << 13, 1 }, { (1 << 13) + (1 << 12), 1},
-	{ 1 << 14, 1 }, { (1 << 14) + (1 << 13), 1},
-	{ 1 << 15, 1 }, { (1 << 15) + (1 << 14), 1},
-	{ 1 << 16, 0 }, { (1 << 16) + (1 << 15), 1},
-	{ 1 << 17, 1 }, { (1 << 17) + (1 << 16), 1},
-	{ 1 << 18, 1 }, { (1 << 18) + (1 << 17), 1},
-	{ 1 << 19, 1 }, { (1 << 19) + (1 << 18), 1},
-	{ 1 << 20, 0 }, { (1 << 20) + (1 << 19), 1},
-	{ 1 << 21, 1 }, { (1 << 21) + (1 << 20), 1},
-	{ 1 << 22, 1 }, { (1 << 22) + (1 << 21), 1},
-	{ 1 << 23, 1 },
+struct ft_timer ft_timer = {
+	.type = FT_TIMER_CLOCK,
+	.ns_per_tick = 1.0,
 };
 
-const unsigned int test_cnt = (sizeof test_size / sizeof test_size[0]);
-
 static int getaddr(char *node, char *service, void **addr,
 			size_t *len)
 {
@@ -104,6 +100,410 @@ int ft_getdestaddr(char *node, char *service, struct fi_info *hints)
 	return getaddr(node, service, &hints->dest_addr, &hints->dest_addrlen);
 }
 
+int ft_sock_listen(char *service)
+{
+	struct addrinfo *ai, hints;
+	int fd, val, ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_socktype = SOCK_STREAM;
+
+	ret = getaddrinfo(NULL, service, &hints, &ai);
+	if (ret) {
+		fprintf(stderr, "getaddrinfo() %s\n", gai_strerror(ret));
+		return -FI_EINVAL;
+	}
+
+	fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		ret = -errno;
+		goto free;
+	}
+
+	val = 1;
+	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof val);
+	if (ret) {
+		perror("setsockopt SO_REUSEADDR");
+		ret = -errno;
+		goto close;
+	}
+
+	ret = bind(fd, ai->ai_addr, ai->ai_addrlen);
+	if (ret) {
+		perror("bind");
+		ret = -errno;
+		goto close;
+	}
+
+	ret = listen(fd, SOMAXCONN);
+	if (ret) {
+		perror("listen");
+		ret = -errno;
+		goto close;
+	}
+
+	freeaddrinfo(ai);
+	return fd;
+
+close:
+	close(fd);
+free:
+	freeaddrinfo(ai);
+	return ret;
+}
+
+int ft_sock_connect(char *node, char *service)
+{
+	struct addrinfo *ai, hints;
+	int fd, val, ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_socktype = SOCK_STREAM;
+
+	ret = getaddrinfo(node, service, &hints, &ai);
+	if (ret) {
+		fprintf(stderr, "getaddrinfo() %s\n", gai_strerror(ret));
+		return -FI_EINVAL;
+	}
+
+	fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		ret = -errno;
+		goto free;
+	}
+
+	val = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof val);
+
+	ret = connect(fd, ai->ai_addr, ai->ai_addrlen);
+	if (ret) {
+		ret = -errno;
+		close(fd);
+		goto free;
+	}
+
+	ret = fd;
+free:
+	freeaddrinfo(ai);
+	return ret;
+}
+
+int ft_sock_accept(int listen_fd)
+{
+	int fd, val;
+
+	fd = accept(listen_fd, NULL, 0);
+	if (fd < 0) {
+		perror("accept");
+		return -errno;
+	}
+
+	val = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof val);
+	return fd;
+}
+
+int ft_sock_send(int fd, void *msg, size_t len)
+{
+	ssize_t ret;
+
+	ret = send(fd, msg, len, 0);
+	if (ret == len) {
+		return 0;
+	} else if (ret < 0) {
+		perror("send");
+		return -errno;
+	} else {
+		perror("send aborted");
+		return -FI_ECONNABORTED;
+	}
+}
+
+int ft_sock_recv(int fd, void *msg, size_t len)
+{
+	ssize_t ret;
+
+	ret = recv(fd, msg, len, MSG_WAITALL);
+	if (ret == len) {
+		return 0;
+	} else if (ret == 0) {
+		return -FI_ENOTCONN;
+	} else if (ret < 0) {
+		perror("recv");
+		return -errno;
+	} else {
+		perror("recv aborted");
+		return -FI_ECONNABORTED;
+	}
+}
+
+void ft_sock_shutdown(int fd)
+{
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+}
+
+int ft_oob_sock = -1;
+static int ft_oob_client;
+
+/*
+ * The server accepts a single client on opts->oob_port.  The client
+ * retries for a while, since it may be started before the server listens.
+ */
+int ft_oob_init(struct cs_opts *opts)
+{
+	int fd, i;
+
+	if (!opts->oob_port || ft_oob_sock >= 0)
+		return 0;
+
+	ft_oob_client = opts->dst_addr != NULL;
+	if (ft_oob_client) {
+		for (i = 0; i < FT_OOB_RETRIES; i++) {
+			ft_oob_sock = ft_sock_connect(opts->dst_addr,
+						      opts->oob_port);
+			if (ft_oob_sock >= 0 || ft_oob_sock != -ECONNREFUSED)
+				break;
+			usleep(FT_OOB_RETRY_USEC);
+		}
+		if (ft_oob_sock < 0) {
+			fprintf(stderr, "unable to connect to %s:%s: %s\n",
+				opts->dst_addr, opts->oob_port,
+				strerror(-ft_oob_sock));
+		}
+	} else {
+		fd = ft_sock_listen(opts->oob_port);
+		if (fd < 0)
+			return fd;
+
+		ft_oob_sock = ft_sock_accept(fd);
+		close(fd);
+	}
+
+	return ft_oob_sock < 0 ? ft_oob_sock : 0;
+}
+
+void ft_oob_fini(void)
+{
+	if (ft_oob_sock >= 0) {
+		ft_sock_shutdown(ft_oob_sock);
+		ft_oob_sock = -1;
+	}
+}
+
+/*
+ * Pair processes share one anonymous mapping holding a barrier and the
+ * results of the last transfer size of every pair.
+ */
+struct ft_pairs {
+	int cnt;
+	volatile int arrived;
+	volatile int gen;
+	volatile int failed;
+	pid_t pid[FT_MAX_PAIRS];
+	struct ft_trials trials[FT_MAX_PAIRS];
+};
+
+int ft_pair_idx;
+static struct ft_pairs *ft_pairs;
+
+static int ft_port_add(char **port, int off)
+{
+	char str[FT_STR_LEN];
+
+	if (!*port)
+		return 0;
+
+	snprintf(str, sizeof str, "%ld", strtol(*port, NULL, 10) + off);
+	*port = strdup(str);
+	return *port ? 0 : -FI_ENOMEM;
+}
+
+static int ft_pairs_barrier(void)
+{
+	int gen;
+
+	if (!ft_pairs)
+		return 0;
+
+	gen = ft_pairs->gen;
+	if (__sync_add_and_fetch(&ft_pairs->arrived, 1) == ft_pairs->cnt) {
+		ft_pairs->arrived = 0;
+		__sync_synchronize();
+		ft_pairs->gen = gen + 1;
+		return 0;
+	}
+
+	while (ft_pairs->gen == gen) {
+		if (ft_pairs->failed)
+			return -FI_ECANCELED;
+		sched_yield();
+	}
+	return 0;
+}
+
+int ft_pairs_fork(struct cs_opts *opts)
+{
+	pid_t pid;
+	int i, ret;
+
+	if (opts->pairs <= 1 || ft_pairs) {
+		ft_perf_init();
+		return 0;
+	}
+
+	ft_pairs = mmap(NULL, sizeof *ft_pairs, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ft_pairs == MAP_FAILED) {
+		ft_pairs = NULL;
+		return -errno;
+	}
+	ft_pairs->cnt = opts->pairs;
+
+	fflush(stdout);
+	for (i = 1; i < opts->pairs; i++) {
+		pid = fork();
+		if (pid < 0) {
+			ret = -errno;
+			perror("fork");
+			ft_pairs->failed = 1;
+			return ret;
+		}
+		if (!pid) {
+			ft_pair_idx = i;
+			break;
+		}
+		ft_pairs->pid[i] = pid;
+	}
+
+	ft_perf_init();
+	ret = ft_port_add(&opts->src_port, ft_pair_idx);
+	if (!ret)
+		ret = ft_port_add(&opts->dst_port, ft_pair_idx);
+	if (!ret)
+		ret = ft_port_add(&opts->oob_port, ft_pair_idx);
+	return ret;
+}
+
+/* Pair 0 waits for the others and fails if any of them did. */
+int ft_pairs_join(int ret)
+{
+	int i, status;
+
+	if (!ft_pairs)
+		return ret;
+
+	if (ret)
+		ft_pairs->failed = 1;
+	if (ft_pair_idx)
+		return ret;
+
+	for (i = 1; i < ft_pairs->cnt; i++) {
+		if (!ft_pairs->pid[i])
+			continue;
+		if (waitpid(ft_pairs->pid[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "pair %d failed\n", i);
+			if (!ret)
+				ret = -FI_EOTHER;
+		}
+	}
+	return ret;
+}
+
+/* Swaps len bytes with the peer; the client sends first. */
+int ft_oob_exchange(void *local, void *remote, size_t len)
+{
+	int ret;
+
+	if (ft_oob_client) {
+		ret = ft_sock_send(ft_oob_sock, local, len);
+		return ret ? ret : ft_sock_recv(ft_oob_sock, remote, len);
+	}
+
+	ret = ft_sock_recv(ft_oob_sock, remote, len);
+	return ret ? ret : ft_sock_send(ft_oob_sock, local, len);
+}
+
+int ft_oob_barrier(void)
+{
+	char local = 0, remote;
+
+	return ft_oob_exchange(&local, &remote, sizeof local);
+}
+
+/*
+ * Exchanges endpoint names with the peer and inserts the peer's address
+ * into av, replacing the in-band address exchange.
+ */
+int ft_oob_av_insert(struct fid_ep *ep, struct fid_av *av, fi_addr_t *addr,
+		     void *context)
+{
+	void *local_name, *remote_name;
+	size_t len = 0, remote_len;
+	uint64_t local_len, msg_len;
+	int ret;
+
+	ret = fi_getname(&ep->fid, NULL, &len);
+	if (ret != -FI_ETOOSMALL) {
+		FT_PRINTERR("fi_getname", ret);
+		return ret;
+	}
+
+	local_name = calloc(1, len);
+	if (!local_name)
+		return -FI_ENOMEM;
+
+	ret = fi_getname(&ep->fid, local_name, &len);
+	if (ret) {
+		FT_PRINTERR("fi_getname", ret);
+		goto free_local;
+	}
+
+	local_len = len;
+	ret = ft_oob_exchange(&local_len, &msg_len, sizeof msg_len);
+	if (ret)
+		goto free_local;
+
+	remote_len = (size_t) msg_len;
+	remote_name = calloc(1, remote_len);
+	if (!remote_name) {
+		ret = -FI_ENOMEM;
+		goto free_local;
+	}
+
+	if (ft_oob_client) {
+		ret = ft_sock_send(ft_oob_sock, local_name, len);
+		if (!ret)
+			ret = ft_sock_recv(ft_oob_sock, remote_name, remote_len);
+	} else {
+		ret = ft_sock_recv(ft_oob_sock, remote_name, remote_len);
+		if (!ret)
+			ret = ft_sock_send(ft_oob_sock, local_name, len);
+	}
+	if (ret)
+		goto free_remote;
+
+	ft_setup_start(FT_SETUP_AV_INSERT);
+	ret = fi_av_insert(av, remote_name, 1, addr, 0, context);
+	ft_setup_end(FT_SETUP_AV_INSERT);
+	if (ret != 1) {
+		FT_PRINTERR("fi_av_insert", ret);
+		ret = ret < 0 ? ret : -FI_EINVAL;
+		goto free_remote;
+	}
+	ret = 0;
+
+free_remote:
+	free(remote_name);
+free_local:
+	free(local_name);
+	return ret;
+}
+
 char *size_str(char str[FT_STR_LEN], long long size)
 {
 	long long base, fraction = 0;
@@ -133,151 +533,1901 @@ char *size_str(char str[FT_STR_LEN], long long size)
 	else
 		snprintf(str, FT_STR_LEN, "%lld%c", size / base, mag);
 
-	return str;
+	return str;
+}
+
+char *cnt_str(char str[FT_STR_LEN], long long cnt)
+{
+	if (cnt >= 1000000000)
+		snprintf(str, FT_STR_LEN, "%lldb", cnt / 1000000000);
+	else if (cnt >= 1000000)
+		snprintf(str, FT_STR_LEN, "%lldm", cnt / 1000000);
+	else if (cnt >= 1000)
+		snprintf(str, FT_STR_LEN, "%lldk", cnt / 1000);
+	else
+		snprintf(str, FT_STR_LEN, "%lld", cnt);
+
+	return str;
+}
+
+int size_to_count(int size)
+{
+	if (size >= (1 << 20))
+		return 100;
+	else if (size >= (1 << 16))
+		return 1000;
+	else if (size >= (1 << 10))
+		return 10000;
+	else
+		return 100000;
+}
+
+static int ft_parse_size(const char *str, char **end, size_t *size)
+{
+	unsigned long long val;
+
+	errno = 0;
+	val = strtoull(str, end, 0);
+	if (errno || *end == str)
+		return -FI_EINVAL;
+
+	switch (**end) {
+	case 'g':
+	case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		val <<= 10;
+		(*end)++;
+		break;
+	default:
+		break;
+	}
+
+	if (val > INT_MAX)
+		return -FI_EINVAL;
+
+	*size = (size_t) val;
+	return 0;
+}
+
+static int ft_size_cmp(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int ft_add_size(size_t **sizes, int *cnt, size_t size)
+{
+	size_t *tmp;
+
+	if (*cnt >= FT_MAX_SIZE_CNT)
+		return -FI_E2BIG;
+
+	if (!(*cnt & (*cnt - 1))) {
+		tmp = realloc(*sizes, (*cnt ? *cnt * 2 : 1) * sizeof **sizes);
+		if (!tmp)
+			return -FI_ENOMEM;
+		*sizes = tmp;
+	}
+
+	(*sizes)[(*cnt)++] = size;
+	return 0;
+}
+
+static int ft_parse_size_range(char *str, size_t **sizes, int *cnt)
+{
+	size_t lo, hi, step = 2, size;
+	int geometric = 1, ret;
+	char *end;
+
+	ret = ft_parse_size(str, &end, &lo);
+	if (ret)
+		return ret;
+
+	if (*end == '\0')
+		return ft_add_size(sizes, cnt, lo);
+	if (*end != ':')
+		return -FI_EINVAL;
+
+	ret = ft_parse_size(end + 1, &end, &hi);
+	if (ret || hi < lo)
+		return -FI_EINVAL;
+
+	if (*end == ':') {
+		end++;
+		if (*end == 'x' || *end == 'X') {
+			geometric = 1;
+		} else if (*end == '+') {
+			geometric = 0;
+		} else {
+			return -FI_EINVAL;
+		}
+
+		ret = ft_parse_size(end + 1, &end, &step);
+		if (ret)
+			return ret;
+	}
+
+	if (*end != '\0' || (geometric && (step < 2 || !lo)) ||
+	    (!geometric && !step))
+		return -FI_EINVAL;
+
+	for (size = lo; size <= hi; size = geometric ? size * step : size + step) {
+		ret = ft_add_size(sizes, cnt, size);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Parses a comma separated list of message sizes and size ranges into a
+ * sorted array without duplicates.  Each element is one of
+ *   <size>               a single size
+ *   <lo>:<hi>[:x<mul>]   lo, lo * mul, ... up to hi (mul defaults to 2)
+ *   <lo>:<hi>:+<inc>     lo, lo + inc, ... up to hi
+ *   all                  the full default sweep
+ * Sizes accept k, m and g suffixes (powers of 1024).  The array is
+ * allocated and must be freed by the caller.
+ */
+int ft_parse_sizes(const char *spec, size_t **sizes, int *cnt)
+{
+	char *str, *elem, *saveptr;
+	size_t *list = NULL;
+	int n = 0, i, j, ret = 0;
+
+	str = strdup(spec);
+	if (!str)
+		return -FI_ENOMEM;
+
+	for (elem = strtok_r(str, ",", &saveptr); elem && !ret;
+	     elem = strtok_r(NULL, ",", &saveptr)) {
+		if (!strcasecmp(elem, "all")) {
+			size_t *all;
+			int all_cnt;
+
+			ret = ft_parse_sizes(FT_ALL_SIZES, &all, &all_cnt);
+			if (ret)
+				break;
+
+			for (i = 0; !ret && i < all_cnt; i++)
+				ret = ft_add_size(&list, &n, all[i]);
+			free(all);
+		} else {
+			ret = ft_parse_size_range(elem, &list, &n);
+		}
+	}
+	free(str);
+
+	if (!ret && !n)
+		ret = -FI_EINVAL;
+	if (ret) {
+		free(list);
+		return ret;
+	}
+
+	qsort(list, n, sizeof *list, ft_size_cmp);
+	for (i = 1, j = 0; i < n; i++) {
+		if (list[i] != list[j])
+			list[++j] = list[i];
+	}
+
+	*sizes = list;
+	*cnt = j + 1;
+	return 0;
+}
+
+/* Number of sizes to sweep, selecting the default sweep if -S was not used. */
+int ft_size_cnt(struct cs_opts *opts)
+{
+	int ret;
+
+	if (!opts->sizes) {
+		ret = ft_parse_sizes(FT_DEFAULT_SIZES, &opts->sizes,
+				     &opts->size_cnt);
+		if (ret) {
+			FT_PRINTERR("ft_parse_sizes", ret);
+			return 0;
+		}
+	}
+
+	return opts->size_cnt;
+}
+
+size_t ft_max_size(struct cs_opts *opts)
+{
+	return ft_size_cnt(opts) ? opts->sizes[opts->size_cnt - 1] : 0;
+}
+
+void init_test(struct cs_opts *opts, char *test_name, size_t test_name_len)
+{
+	char sstr[FT_STR_LEN];
+
+	ft_timer_init(opts->timer);
+
+	size_str(sstr, opts->transfer_size);
+	snprintf(test_name, test_name_len, "%s_lat", sstr);
+	if (!(opts->user_options & FT_OPT_ITER))
+		opts->iterations = size_to_count(opts->transfer_size);
+}
+
+int ft_cq_batch = FT_CQ_BATCH;
+enum ft_cq_wait_mode ft_cq_wait_mode = FT_CQ_BUSY;
+int ft_cq_spin_usec = FT_CQ_SPIN_USEC;
+struct ft_cq_stats ft_cq_stats;
+
+static ssize_t ft_cq_read(struct fid_cq *cq, size_t entry_size, int count,
+			  ft_cq_cb cb, void *arg, int block)
+{
+	struct fi_cq_tagged_entry comp[FT_CQ_BATCH_MAX];
+	ssize_t ret, i;
+
+	count = MIN(count, ft_cq_batch);
+	count = MIN(count, sizeof comp / entry_size);
+
+	if (block) {
+		ret = fi_cq_sread(cq, comp, count, NULL, -1);
+		ft_cq_stats.sreads++;
+	} else {
+		ret = fi_cq_read(cq, comp, count);
+	}
+	ft_cq_stats.reads++;
+	if (ret > 0) {
+		ft_trace(FT_TRACE_COMP, FT_TRACE_ANY, (uint32_t) ret);
+		ft_cq_stats.hits++;
+		ft_cq_stats.entries += ret;
+		for (i = 0; cb && i < ret; i++)
+			cb((char *) comp + i * entry_size, arg);
+	} else if (ret == -FI_EAGAIN) {
+		ft_trace(FT_TRACE_EAGAIN, FT_TRACE_ANY, 0);
+		ft_cq_stats.empty++;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Reads up to count completions with a single fi_cq_read() call, limited
+ * to ft_cq_batch entries, and passes each one to cb if given.  entry_size
+ * must match the format the CQ was opened with.  Returns the number of
+ * completions read, 0 if the CQ was empty, or a negative error code.
+ */
+ssize_t ft_cq_reap(struct fid_cq *cq, size_t entry_size, int count,
+		   ft_cq_cb cb, void *arg)
+{
+	return ft_cq_read(cq, entry_size, count, cb, arg, 0);
+}
+
+static uint64_t ft_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Like ft_cq_reap, but waits in the way selected by ft_cq_wait_mode until
+ * at least one completion is available.
+ */
+ssize_t ft_cq_get(struct fid_cq *cq, size_t entry_size, int count,
+		  ft_cq_cb cb, void *arg)
+{
+	uint64_t deadline = 0;
+	ssize_t ret;
+
+	switch (ft_cq_wait_mode) {
+	case FT_CQ_SPIN_BLOCK:
+		do {
+			ret = ft_cq_read(cq, entry_size, count, cb, arg, 0);
+			if (ret)
+				return ret;
+			if (!deadline)
+				deadline = ft_now_ns() + ft_cq_spin_usec * 1000ULL;
+		} while (ft_now_ns() < deadline);
+		/* fall through */
+	case FT_CQ_BLOCK:
+		do {
+			ret = ft_cq_read(cq, entry_size, count, cb, arg, 1);
+		} while (!ret);
+		return ret;
+	default:
+		do {
+			ret = ft_cq_read(cq, entry_size, count, cb, arg, 0);
+		} while (!ret);
+		return ret;
+	}
+}
+
+/* Reaps exactly count completions, waiting until they arrive. */
+int ft_cq_wait(struct fid_cq *cq, size_t entry_size, int count,
+	       ft_cq_cb cb, void *arg)
+{
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = ft_cq_get(cq, entry_size, count, cb, arg);
+		if (ret < 0) {
+			if (ret == -FI_EAVAIL) {
+				cq_readerr(cq, "cq");
+			} else if (ft_cq_wait_mode == FT_CQ_BUSY) {
+				FT_PRINTERR("fi_cq_read", ret);
+			} else {
+				FT_PRINTERR("fi_cq_sread", ret);
+			}
+			return ret;
+		}
+		count -= ret;
+	}
+	return 0;
+}
+
+enum fi_wait_obj ft_cq_wait_obj(void)
+{
+	return ft_cq_wait_mode == FT_CQ_BUSY ? FI_WAIT_NONE : FI_WAIT_UNSPEC;
+}
+
+const char *ft_cq_wait_str(void)
+{
+	switch (ft_cq_wait_mode) {
+	case FT_CQ_BLOCK:
+		return "block";
+	case FT_CQ_SPIN_BLOCK:
+		return "spin";
+	default:
+		return "busy";
+	}
+}
+
+void ft_cq_stats_reset(void)
+{
+	memset(&ft_cq_stats, 0, sizeof ft_cq_stats);
+}
+
+static const char *ft_setup_name[] = {
+	[FT_SETUP_GETINFO] = "fi_getinfo",
+	[FT_SETUP_FABRIC] = "fi_fabric",
+	[FT_SETUP_DOMAIN] = "fi_domain",
+	[FT_SETUP_ENDPOINT] = "fi_endpoint",
+	[FT_SETUP_CQ] = "fi_cq_open",
+	[FT_SETUP_CNTR] = "fi_cntr_open",
+	[FT_SETUP_MR] = "fi_mr_reg",
+	[FT_SETUP_AV] = "fi_av_open",
+	[FT_SETUP_ENABLE] = "fi_enable",
+	[FT_SETUP_AV_INSERT] = "fi_av_insert",
+	[FT_SETUP_CONNECT] = "connect"
+};
+
+static struct {
+	uint64_t start;
+	uint64_t nsec;
+	int calls;
+} ft_setup[FT_SETUP_MAX];
+
+void ft_setup_start(enum ft_setup_op op)
+{
+	ft_setup[op].start = ft_now_ns();
+}
+
+void ft_setup_end(enum ft_setup_op op)
+{
+	ft_setup[op].nsec += ft_now_ns() - ft_setup[op].start;
+	ft_setup[op].calls++;
+}
+
+uint64_t ft_setup_nsec(enum ft_setup_op op, int *calls)
+{
+	*calls = ft_setup[op].calls;
+	return ft_setup[op].nsec;
+}
+
+const char *ft_setup_str(enum ft_setup_op op)
+{
+	return ft_setup_name[op];
+}
+
+void ft_setup_reset(void)
+{
+	memset(ft_setup, 0, sizeof ft_setup);
+}
+
+static uint64_t ft_setup_total(void)
+{
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < FT_SETUP_MAX; i++)
+		total += ft_setup[i].nsec;
+	return total;
+}
+
+int wait_for_data_completion(struct fid_cq *cq, int num_completions)
+{
+	return ft_cq_wait(cq, sizeof(struct fi_cq_data_entry), num_completions,
+			  NULL, NULL);
+}
+
+int wait_for_completion(struct fid_cq *cq, int num_completions)
+{
+	return ft_cq_wait(cq, sizeof(struct fi_cq_entry), num_completions,
+			  NULL, NULL);
+}
+
+void cq_readerr(struct fid_cq *cq, char *cq_str)
+{ 
+	struct fi_cq_err_entry cq_err;
+	const char *err_str;
+	int ret;
+
+	ret = fi_cq_readerr(cq, &cq_err, 0);
+	if (ret < 0)
+		FT_PRINTERR("fi_cq_readerr", ret);
+
+	err_str = fi_cq_strerror(cq, cq_err.prov_errno, cq_err.err_data, NULL, 0);
+	fprintf(stderr, "%s %s (%d)\n", cq_str, err_str, cq_err.prov_errno);
+}
+
+int ft_finalize(struct fid_ep *tx_ep, struct fid_cq *scq, struct fid_cq *rcq,
+		fi_addr_t addr)
+{
+	struct fi_msg msg;
+	struct iovec iov;
+	struct fi_context tx_ctx;
+	char buf[4] = "fin";
+	int ret;
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof buf;
+	msg.msg_iov = &iov;
+	msg.desc = NULL;
+	msg.iov_count = 1;
+	msg.addr = addr;
+	msg.context = &tx_ctx;
+	msg.data = 0;
+
+	ret = fi_sendmsg(tx_ep, &msg, FI_INJECT | FI_REMOTE_COMPLETE);
+	if (ret) {
+		FT_PRINTERR("fi_sendmsg", ret);
+		return ret;
+	}
+
+	wait_for_data_completion(scq, 1);
+	wait_for_data_completion(rcq, 1);
+	return 0;
+}
+
+int64_t get_elapsed(const struct timespec *b, const struct timespec *a,
+		    enum precision p)
+{
+    int64_t elapsed;
+
+    elapsed = (a->tv_sec - b->tv_sec) * 1000 * 1000 * 1000;
+    elapsed += a->tv_nsec - b->tv_nsec;
+    return elapsed / p;
+}
+
+const char *ft_timer_str(enum ft_timer_type type)
+{
+	return type == FT_TIMER_TSC ? "tsc" : "clock";
+}
+
+#if FT_HAVE_TSC
+static int ft_tsc_invariant(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+	    eax < 0x80000007)
+		return 0;
+
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx >> 8) & 1;
+}
+
+/* Measure TSC frequency against CLOCK_MONOTONIC over ~20 ms. */
+static double ft_tsc_calibrate(void)
+{
+	struct timespec b, a;
+	uint64_t tb, ta;
+	unsigned int aux;
+
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	tb = __rdtscp(&aux);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &a);
+	} while (get_elapsed(&b, &a, MILLI) < 20);
+	ta = __rdtscp(&aux);
+
+	return (double) get_elapsed(&b, &a, NANO) / (ta - tb);
+}
+#endif
+
+/* Smallest observed cost of back to back timer reads, in nanoseconds. */
+static uint64_t ft_timer_calc_overhead(void)
+{
+	uint64_t t0, t1, min = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		t0 = ft_timer_ticks();
+		t1 = ft_timer_ticks();
+		if (t1 - t0 < min)
+			min = t1 - t0;
+	}
+
+	return ft_timer_ns(min);
+}
+
+int ft_timer_init(enum ft_timer_type type)
+{
+	static enum ft_timer_type requested;
+	static int init;
+
+	if (init && requested == type)
+		return ft_timer.type == type ? 0 : -FI_ENOSYS;
+
+	ft_timer.type = FT_TIMER_CLOCK;
+	ft_timer.ns_per_tick = 1.0;
+#if FT_HAVE_TSC
+	if (type == FT_TIMER_TSC && ft_tsc_invariant()) {
+		ft_timer.ns_per_tick = ft_tsc_calibrate();
+		ft_timer.type = FT_TIMER_TSC;
+	}
+#endif
+	ft_timer.overhead = ft_timer_calc_overhead();
+	requested = type;
+	init = 1;
+
+	return ft_timer.type == type ? 0 : -FI_ENOSYS;
+}
+
+void ft_hist_reset(struct ft_hist *hist)
+{
+	memset(hist, 0, sizeof *hist);
+	hist->min = UINT64_MAX;
+}
+
+static uint64_t ft_hist_bucket_max(int index)
+{
+	int shift;
+
+	if (index < FT_HIST_SUB_CNT)
+		return (uint64_t) index;
+
+	shift = (index >> FT_HIST_SUB_BITS) - 1;
+	return (((uint64_t) (FT_HIST_SUB_CNT + (index & (FT_HIST_SUB_CNT - 1))))
+		<< shift) + ((1ULL << shift) - 1);
+}
+
+/*
+ * Returns the smallest recorded value such that pct percent of all samples
+ * are less than or equal to it, within the resolution of the bucket.
+ */
+uint64_t ft_hist_percentile(struct ft_hist *hist, double pct)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (!hist->count)
+		return 0;
+
+	rank = (uint64_t) (pct / 100.0 * hist->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank >= hist->count)
+		return hist->max;
+
+	for (i = 0; i < FT_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank)
+			return MAX(MIN(ft_hist_bucket_max(i), hist->max), hist->min);
+	}
+
+	return hist->max;
+}
+
+void ft_trials_reset(struct ft_trials *trials)
+{
+	memset(trials, 0, sizeof *trials);
+	ft_cq_stats_reset();
+}
+
+static void ft_trials_add_ns(struct ft_trials *trials, int64_t elapsed,
+			     int iters)
+{
+	double usec, delta;
+
+	trials->cnt++;
+	trials->iters += iters;
+	trials->elapsed += elapsed;
+
+	usec = (double) elapsed / 1000.0 / iters;
+	delta = usec - trials->mean;
+	trials->mean += delta / trials->cnt;
+	trials->m2 += delta * (usec - trials->mean);
+}
+
+/*
+ * Adds one timed loop of iters iterations.  Loops that sample every
+ * iteration into hist are charged one timer read per iteration, which is
+ * removed here.  Per-trial usec/iteration is folded into a running mean
+ * and variance (Welford).
+ */
+void ft_trials_add(struct ft_trials *trials, struct timespec *start,
+		   struct timespec *end, int iters, struct ft_hist *hist)
+{
+	int64_t elapsed = get_elapsed(start, end, NANO);
+
+	if (hist)
+		elapsed -= (int64_t) iters * ft_timer.overhead;
+
+	ft_trials_add_ns(trials, elapsed, iters);
+}
+
+double ft_trials_stddev(struct ft_trials *trials)
+{
+	return trials->cnt > 1 ? sqrt(trials->m2 / (trials->cnt - 1)) : 0.0;
+}
+
+/* Half width of the 95% confidence interval of the mean (Student's t). */
+double ft_trials_ci95(struct ft_trials *trials)
+{
+	static const double t975[] = {
+		0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+		2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+		2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+		2.052, 2.048, 2.045, 2.042
+	};
+	int df = trials->cnt - 1;
+	double t;
+
+	if (df < 1)
+		return 0.0;
+
+	t = df < ARRAY_SIZE(t975) ? t975[df] : 1.960;
+	return t * ft_trials_stddev(trials) / sqrt(trials->cnt);
+}
+
+#ifdef __linux__
+static const uint64_t ft_perf_event[] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+static int ft_perf_fd[ARRAY_SIZE(ft_perf_event)];
+static int ft_perf_state;	/* 0 unopened, 1 open, -1 unavailable */
+
+static int ft_perf_open(int exclude_kernel)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ft_perf_event); i++) {
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = ft_perf_event[i];
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.inherit = 1;
+		attr.exclude_kernel = exclude_kernel;
+		attr.exclude_hv = 1;
+
+		ft_perf_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (ft_perf_fd[i] < 0) {
+			while (i--)
+				close(ft_perf_fd[i]);
+			return -FI_ENOSYS;
+		}
+	}
+	return 0;
+}
+
+void ft_perf_init(void)
+{
+	if (!ft_perf_state)
+		ft_perf_state = (!ft_perf_open(0) || !ft_perf_open(1)) ? 1 : -1;
+}
+
+int ft_perf_read(struct ft_perf_cnt *cnt)
+{
+	uint64_t val[ARRAY_SIZE(ft_perf_event)], buf[3];
+	int i;
+
+	ft_perf_init();
+	if (ft_perf_state < 0)
+		return -FI_ENOSYS;
+
+	for (i = 0; i < ARRAY_SIZE(ft_perf_event); i++) {
+		if (read(ft_perf_fd[i], buf, sizeof buf) != sizeof buf)
+			return -FI_EIO;
+		val[i] = (buf[2] && buf[2] < buf[1]) ?
+			(uint64_t) ((double) buf[0] * buf[1] / buf[2]) : buf[0];
+	}
+
+	cnt->cycles = val[0];
+	cnt->instrs = val[1];
+	cnt->llc_misses = val[2];
+	return 0;
+}
+#else
+void ft_perf_init(void)
+{
+}
+
+int ft_perf_read(struct ft_perf_cnt *cnt)
+{
+	return -FI_ENOSYS;
+}
+#endif
+
+/* Scaled counts of multiplexed counters are estimates and may go back. */
+static uint64_t ft_perf_delta(uint64_t start, uint64_t end)
+{
+	return end > start ? end - start : 0;
+}
+
+static int64_t ft_tv_usec(const struct timeval *b, const struct timeval *a)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000LL + (a->tv_usec - b->tv_usec);
+}
+
+/*
+ * Runs one timed batch and returns its elapsed nanoseconds.  The CPU time
+ * and hardware events counted meanwhile are added to trials.
+ */
+static int64_t ft_run_batch(int (*run)(int iters), int iters,
+			    struct ft_hist *hist, struct ft_trials *trials,
+			    int *ret)
+{
+	struct timespec start, end;
+	struct rusage ru_start, ru_end;
+	struct ft_perf_cnt hw_start, hw_end;
+	int64_t elapsed, verify;
+	uint64_t verify_start;
+	int perf;
+
+	verify_start = ft_verify.ticks;
+	getrusage(RUSAGE_SELF, &ru_start);
+	perf = !ft_perf_read(&hw_start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	*ret = run(iters);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	perf = perf && !ft_perf_read(&hw_end);
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	trials->utime += ft_tv_usec(&ru_start.ru_utime, &ru_end.ru_utime);
+	trials->stime += ft_tv_usec(&ru_start.ru_stime, &ru_end.ru_stime);
+	if (perf) {
+		trials->perf = 1;
+		trials->hw.cycles += ft_perf_delta(hw_start.cycles,
+						   hw_end.cycles);
+		trials->hw.instrs += ft_perf_delta(hw_start.instrs,
+						   hw_end.instrs);
+		trials->hw.llc_misses += ft_perf_delta(hw_start.llc_misses,
+						       hw_end.llc_misses);
+	}
+	elapsed = get_elapsed(&start, &end, NANO);
+	if (hist)
+		elapsed -= (int64_t) iters * ft_timer.overhead;
+	verify = ft_timer_ns(ft_verify.ticks - verify_start);
+	trials->verify += verify;
+	return elapsed - verify;
+}
+
+static int ft_adaptive(struct cs_opts *opts)
+{
+	return (opts->time_budget > 0 || opts->converge > 0) &&
+		!(opts->user_options & FT_OPT_ITER);
+}
+
+/*
+ * One trial run as a sequence of batches chosen by the client.  The batch
+ * size doubles from 1 until a batch takes FT_BATCH_NSEC, after which
+ * batches are kept at that size.  The trial ends when the time budget is
+ * spent or, in convergence mode, when the relative stddev of the
+ * per-iteration time of at least FT_CONVERGE_BATCHES equal batches drops
+ * below opts->converge percent.  Fixed iteration counts are sent as a
+ * single batch.
+ */
+static int ft_run_leader(struct cs_opts *opts, int (*run)(int iters),
+			 int (*sync)(int *iters), struct ft_hist *hist,
+			 struct ft_trials *trials)
+{
+	int64_t budget, target, elapsed, total = 0;
+	double usec, delta, mean = 0.0, m2 = 0.0;
+	int iters, done = 0, sized = 0, cnt = 0, ret;
+	long long sum = 0;
+
+	if (!ft_adaptive(opts)) {
+		iters = opts->iterations;
+		ret = sync(&iters);
+		if (ret)
+			return ret;
+
+		elapsed = ft_run_batch(run, iters, hist, trials, &ret);
+		if (ret)
+			return ret;
+
+		ft_trials_add_ns(trials, elapsed, iters);
+		iters = 0;
+		return sync(&iters);
+	}
+
+	budget = (int64_t) ((opts->time_budget > 0 ? opts->time_budget :
+			     FT_CONVERGE_MAX_SEC) * 1000000000.0);
+	target = MIN(FT_BATCH_NSEC, budget / 10);
+	iters = 1;
+
+	while (!done) {
+		ret = sync(&iters);
+		if (ret)
+			return ret;
+
+		elapsed = ft_run_batch(run, iters, hist, trials, &ret);
+		if (ret)
+			return ret;
+
+		total += elapsed;
+		sum += iters;
+
+		if (!sized && elapsed >= target)
+			sized = 1;
+
+		if (sized) {
+			usec = (double) elapsed / 1000.0 / iters;
+			delta = usec - mean;
+			mean += delta / ++cnt;
+			m2 += delta * (usec - mean);
+		}
+
+		if (total >= budget || sum >= INT_MAX / 2) {
+			done = 1;
+		} else if (opts->converge > 0 && cnt >= FT_CONVERGE_BATCHES &&
+			   sqrt(m2 / (cnt - 1)) * 100.0 <= opts->converge * mean) {
+			done = 1;
+		} else if (!sized) {
+			iters = MIN(iters * 2, INT_MAX / 4);
+		} else if ((total + elapsed) > budget) {
+			/* trim the last batch to the remaining budget */
+			iters = MAX((budget - total) * iters / MAX(elapsed, 1), 1);
+		}
+	}
+
+	ft_trials_add_ns(trials, total, (int) sum);
+
+	iters = 0;
+	return sync(&iters);
+}
+
+/* The server runs whatever batches the client asks for. */
+static int ft_run_follower(int (*run)(int iters), int (*sync)(int *iters),
+			   struct ft_hist *hist, struct ft_trials *trials)
+{
+	int64_t elapsed, total = 0;
+	long long sum = 0;
+	int iters = 0, ret;
+
+	for (;;) {
+		ret = sync(&iters);
+		if (ret)
+			return ret;
+		if (!iters)
+			break;
+
+		elapsed = ft_run_batch(run, iters, hist, trials, &ret);
+		if (ret)
+			return ret;
+
+		total += elapsed;
+		sum += iters;
+	}
+
+	if (sum)
+		ft_trials_add_ns(trials, total, (int) sum);
+	return 0;
+}
+
+/* Carries the batch size from client to server over the control channel. */
+static int ft_oob_sync(int *iters)
+{
+	int peer, ret;
+
+	ret = ft_oob_exchange(iters, &peer, sizeof peer);
+	if (!ret && !ft_oob_client)
+		*iters = peer;
+	return ret;
+}
+
+static struct ft_trials ft_peer_trials;
+static int ft_peer_valid;
+
+/*
+ * Runs opts->warmup_iterations untimed iterations of run, followed by
+ * opts->repeat timed trials.  hist, if given, is cleared after the warmup
+ * so only timed iterations are reported.
+ *
+ * Without sync each trial runs opts->iterations.  With sync, the client
+ * (opts->dst_addr set) chooses the number of iterations of every batch,
+ * adapting it to opts->time_budget or opts->converge when requested, and
+ * passes it to the server through sync, which must carry the value from
+ * client to server.  A count of 0 ends the trial.
+ *
+ * With the control channel open, batches are synchronized over it rather
+ * than through sync, trials without sync start after a barrier, and the
+ * results of both sides are exchanged at the end.
+ */
+int ft_run_trials(struct cs_opts *opts, int (*run)(int iters),
+		  int (*sync)(int *iters), struct ft_hist *hist,
+		  struct ft_trials *trials)
+{
+	int64_t elapsed;
+	int ret, i;
+
+	if (opts->warmup_iterations) {
+		ret = run(opts->warmup_iterations);
+		if (ret)
+			return ret;
+	}
+
+	if (hist)
+		ft_hist_reset(hist);
+	ft_trials_reset(trials);
+	ft_peer_valid = 0;
+
+	if (sync && ft_oob_sock >= 0)
+		sync = ft_oob_sync;
+
+	ret = ft_pairs_barrier();
+	if (ret)
+		return ret;
+
+	for (i = 0; i < opts->repeat; i++) {
+		if (!sync) {
+			if (ft_oob_sock >= 0) {
+				ret = ft_oob_barrier();
+				if (ret)
+					return ret;
+			}
+
+			elapsed = ft_run_batch(run, opts->iterations, hist,
+					       trials, &ret);
+			if (ret)
+				return ret;
+
+			ft_trials_add_ns(trials, elapsed, opts->iterations);
+		} else if (opts->dst_addr) {
+			ret = ft_run_leader(opts, run, sync, hist, trials);
+		} else {
+			ret = ft_run_follower(run, sync, hist, trials);
+		}
+		if (ret)
+			return ret;
+	}
+
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_exchange(trials, &ft_peer_trials, sizeof *trials);
+		if (ret)
+			return ret;
+		ft_peer_valid = 1;
+	}
+
+	if (ft_pairs) {
+		ft_pairs->trials[ft_pair_idx] = *trials;
+		return ft_pairs_barrier();
+	}
+	return 0;
+}
+
+int ft_parse_rates(const char *spec, uint64_t **rates, int *cnt)
+{
+	uint64_t *list;
+	double val;
+	char *end;
+	int n = 0;
+
+	list = calloc(FT_MAX_RATE_CNT, sizeof *list);
+	if (!list)
+		return -FI_ENOMEM;
+
+	while (*spec && n < FT_MAX_RATE_CNT) {
+		val = strtod(spec, &end);
+		switch (*end) {
+		case 'g':
+		case 'G':
+			val *= 1000;
+			/* fall through */
+		case 'm':
+		case 'M':
+			val *= 1000;
+			/* fall through */
+		case 'k':
+		case 'K':
+			val *= 1000;
+			end++;
+			break;
+		}
+		if (end == spec || val < 1 || (*end && *end != ',')) {
+			free(list);
+			return -FI_EINVAL;
+		}
+
+		list[n++] = (uint64_t) val;
+		spec = *end ? end + 1 : end;
+	}
+	if (!n || *spec) {
+		free(list);
+		return -FI_EINVAL;
+	}
+
+	*rates = list;
+	*cnt = n;
+	return 0;
+}
+
+int ft_run_load(struct cs_opts *opts, uint64_t rate, int (*send)(void),
+		int (*poll)(void), struct ft_hist *hist,
+		struct ft_trials *trials)
+{
+	uint64_t start, now, nsec;
+	double interval;
+	int sent = 0, done = 0, ret;
+
+	ft_hist_reset(hist);
+	ft_trials_reset(trials);
+	trials->offered = rate;
+	interval = 1000000000.0 / rate / ft_timer.ns_per_tick;
+
+	start = ft_timer_ticks();
+	while (done < opts->iterations) {
+		now = ft_timer_ticks();
+		while (sent < opts->iterations &&
+		       sent - done < FT_LOAD_WINDOW &&
+		       start + (uint64_t) (sent * interval) <= now) {
+			ret = send();
+			if (ret == -FI_EAGAIN)
+				break;
+			if (ret)
+				return ret;
+			sent++;
+		}
+
+		ret = poll();
+		if (ret < 0)
+			return ret;
+		if (ret)
+			now = ft_timer_ticks();
+
+		for (; ret > 0; ret--, done++) {
+			nsec = ft_timer_ns(now - start -
+					   (uint64_t) (done * interval));
+			nsec = nsec > ft_timer.overhead ?
+			       nsec - ft_timer.overhead : 0;
+			ft_hist_record(hist, nsec);
+			ft_trace(FT_TRACE_LAP, FT_TRACE_ANY, nsec > UINT32_MAX ?
+				 UINT32_MAX : (uint32_t) nsec);
+		}
+	}
+
+	ft_trials_add_ns(trials, ft_timer_ns(ft_timer_ticks() - start),
+			 opts->iterations);
+	return 0;
+}
+
+/*
+ * Process placement requested with -P and -N.  Threads created after the
+ * options are parsed, including provider progress threads, inherit the
+ * CPU affinity and memory policy.
+ */
+static int ft_buf_node = -1;
+
+#ifdef __linux__
+#define FT_MAX_NUMA_NODES	1024
+
+static int ft_parse_cpus(const char *list, cpu_set_t *set)
+{
+	const char *str = list;
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+	while (*str) {
+		lo = strtol(str, &end, 10);
+		if (end == str || lo < 0)
+			return -FI_EINVAL;
+
+		hi = lo;
+		if (*end == '-') {
+			str = end + 1;
+			hi = strtol(str, &end, 10);
+			if (end == str || hi < lo)
+				return -FI_EINVAL;
+		}
+
+		if (hi >= CPU_SETSIZE)
+			return -FI_EINVAL;
+
+		for (; lo <= hi; lo++)
+			CPU_SET(lo, set);
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -FI_EINVAL;
+		str = end;
+	}
+
+	return CPU_COUNT(set) ? 0 : -FI_EINVAL;
+}
+
+static char *ft_cpus_str(char *str, size_t len)
+{
+	cpu_set_t set;
+	size_t n = 0;
+	int cpu, last;
+
+	str[0] = '\0';
+	if (sched_getaffinity(0, sizeof set, &set))
+		return str;
+
+	for (cpu = 0; cpu < CPU_SETSIZE && n < len; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+
+		for (last = cpu; last + 1 < CPU_SETSIZE &&
+		     CPU_ISSET(last + 1, &set); last++)
+			;
+
+		if (last == cpu)
+			n += snprintf(str + n, len - n, "%s%d", n ? "," : "", cpu);
+		else
+			n += snprintf(str + n, len - n, "%s%d-%d", n ? "," : "",
+				      cpu, last);
+		cpu = last;
+	}
+
+	return str;
+}
+
+static void ft_node_mask(int node, unsigned long *mask)
+{
+	memset(mask, 0, FT_MAX_NUMA_NODES / 8);
+	mask[node / (8 * sizeof *mask)] |= 1UL << (node % (8 * sizeof *mask));
+}
+
+static int ft_set_cpus(const char *list)
+{
+	cpu_set_t set;
+	int ret;
+
+	ret = ft_parse_cpus(list, &set);
+	if (ret)
+		return ret;
+
+	return sched_setaffinity(0, sizeof set, &set) ? -errno : 0;
+}
+
+static int ft_set_mem_node(int node)
+{
+	unsigned long mask[FT_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= FT_MAX_NUMA_NODES)
+		return -FI_EINVAL;
+
+	ft_node_mask(node, mask);
+	return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+		       FT_MAX_NUMA_NODES + 1) ? -errno : 0;
+}
+
+/*
+ * Binds the pages of a data buffer to the requested node and faults them
+ * in, so that the first timed transfer does not pay for page allocation.
+ * The node the buffer landed on is reported with the results.
+ */
+int ft_place_buf(struct cs_opts *opts, void *buf, size_t size)
+{
+	unsigned long mask[FT_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+	uintptr_t page = sysconf(_SC_PAGESIZE), start, end;
+	int node, ret = 0;
+
+	if (!buf || !size)
+		return 0;
+
+	if (opts->mem_node >= 0) {
+		start = (uintptr_t) buf & ~(page - 1);
+		end = ((uintptr_t) buf + size + page - 1) & ~(page - 1);
+		ft_node_mask(opts->mem_node, mask);
+		if (syscall(SYS_mbind, start, end - start, MPOL_BIND, mask,
+			    FT_MAX_NUMA_NODES + 1, MPOL_MF_MOVE)) {
+			ret = -errno;
+			FT_PRINTERR("mbind", ret);
+		}
+	}
+
+	memset(buf, 0, size);
+
+	if (!syscall(SYS_get_mempolicy, &node, NULL, 0, buf,
+		     MPOL_F_NODE | MPOL_F_ADDR))
+		ft_buf_node = node;
+
+	return ret;
+}
+
+static int ft_cur_cpu(void)
+{
+	return sched_getcpu();
+}
+#else
+static char *ft_cpus_str(char *str, size_t len)
+{
+	str[0] = '\0';
+	return str;
+}
+
+static int ft_set_cpus(const char *list)
+{
+	return -FI_ENOSYS;
+}
+
+static int ft_set_mem_node(int node)
+{
+	return -FI_ENOSYS;
+}
+
+int ft_place_buf(struct cs_opts *opts, void *buf, size_t size)
+{
+	if (buf && size)
+		memset(buf, 0, size);
+	return 0;
+}
+
+static int ft_cur_cpu(void)
+{
+	return -1;
+}
+#endif
+
+/*
+ * Data buffers handed out by ft_alloc_buf(), so ft_free_buf() knows how
+ * each one was allocated.
+ */
+struct ft_buf {
+	void *buf;
+	size_t size;
+	enum ft_buf_type type;
+	struct ft_buf *next;
+};
+
+static struct ft_buf *ft_bufs;
+
+const char *ft_buf_str(enum ft_buf_type type)
+{
+	switch (type) {
+	case FT_BUF_MALLOC:
+		return "malloc";
+	case FT_BUF_PAGE:
+		return "page";
+	case FT_BUF_THP:
+		return "thp";
+	case FT_BUF_HUGETLB:
+		return "hugetlb";
+	default:
+		return "unknown";
+	}
+}
+
+static size_t ft_align(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+/*
+ * Allocates a data buffer using the allocator selected with -B.  page
+ * buffers are page aligned, thp buffers are aligned to and sized in
+ * FT_HUGEPAGE_SIZE units and advised for transparent hugepages, and
+ * hugetlb buffers are mapped from the hugetlbfs pool.  The buffer is
+ * placed with ft_place_buf(), which also prefaults it.
+ */
+void *ft_alloc_buf(struct cs_opts *opts, size_t size)
+{
+	struct ft_buf *entry;
+	size_t page = sysconf(_SC_PAGESIZE);
+	void *buf = NULL;
+
+	entry = calloc(1, sizeof *entry);
+	if (!entry)
+		return NULL;
+
+	entry->type = opts->buf_type;
+	switch (opts->buf_type) {
+	case FT_BUF_MALLOC:
+		entry->size = size;
+		buf = malloc(size);
+		break;
+	case FT_BUF_PAGE:
+		entry->size = ft_align(size, page);
+		if (posix_memalign(&buf, page, entry->size))
+			buf = NULL;
+		break;
+	case FT_BUF_THP:
+		entry->size = ft_align(size, FT_HUGEPAGE_SIZE);
+		if (posix_memalign(&buf, FT_HUGEPAGE_SIZE, entry->size)) {
+			buf = NULL;
+			break;
+		}
+#ifdef MADV_HUGEPAGE
+		if (madvise(buf, entry->size, MADV_HUGEPAGE))
+			FT_PRINTERR("madvise", -errno);
+#endif
+		break;
+	case FT_BUF_HUGETLB:
+#ifdef MAP_HUGETLB
+		entry->size = ft_align(size, FT_HUGEPAGE_SIZE);
+		buf = mmap(NULL, entry->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (buf == MAP_FAILED) {
+			FT_PRINTERR("mmap", -errno);
+			buf = NULL;
+		}
+#endif
+		break;
+	}
+
+	if (!buf) {
+		free(entry);
+		return NULL;
+	}
+
+	entry->buf = buf;
+	entry->next = ft_bufs;
+	ft_bufs = entry;
+
+	ft_place_buf(opts, buf, entry->size);
+	return buf;
+}
+
+void ft_free_buf(void *buf)
+{
+	struct ft_buf **prev, *entry;
+
+	if (!buf)
+		return;
+
+	for (prev = &ft_bufs; *prev; prev = &(*prev)->next) {
+		if ((*prev)->buf == buf)
+			break;
+	}
+
+	entry = *prev;
+	if (!entry) {
+		free(buf);
+		return;
+	}
+
+	*prev = entry->next;
+	if (entry->type == FT_BUF_HUGETLB)
+		munmap(buf, entry->size);
+	else
+		free(buf);
+	free(entry);
+}
+
+/*
+ * Payload pattern: word i of message seq holds base(seq) + i * step, which
+ * vector units generate with one add per register.  A trailing partial
+ * word holds the leading bytes of the next pattern word.
+ */
+#define FT_PATTERN_MUL	0xbf58476d1ce4e5b9ULL
+#define FT_PATTERN_STEP	0x9e3779b97f4a7c15ULL
+
+struct ft_verify ft_verify;
+
+static void ft_fill_scalar(void *buf, size_t words, uint64_t val)
+{
+	size_t i;
+
+	for (i = 0; i < words; i++, val += FT_PATTERN_STEP)
+		memcpy((char *) buf + i * 8, &val, 8);
+}
+
+/* Returns the OR of the XOR of every word with its expected value. */
+static uint64_t ft_diff_scalar(const void *buf, size_t words, uint64_t val)
+{
+	uint64_t word, diff = 0;
+	size_t i;
+
+	for (i = 0; i < words; i++, val += FT_PATTERN_STEP) {
+		memcpy(&word, (const char *) buf + i * 8, 8);
+		diff |= word ^ val;
+	}
+	return diff;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void ft_fill_sse2(void *buf, size_t words, uint64_t val)
+{
+	__m128i v, inc;
+	size_t i;
+
+	v = _mm_set_epi64x(val + FT_PATTERN_STEP, val);
+	inc = _mm_set1_epi64x(2 * FT_PATTERN_STEP);
+	for (i = 0; i + 2 <= words; i += 2) {
+		_mm_storeu_si128((__m128i *) ((char *) buf + i * 8), v);
+		v = _mm_add_epi64(v, inc);
+	}
+	ft_fill_scalar((char *) buf + i * 8, words - i,
+		       val + i * FT_PATTERN_STEP);
+}
+
+__attribute__((target("sse2")))
+static uint64_t ft_diff_sse2(const void *buf, size_t words, uint64_t val)
+{
+	__m128i v, inc, acc;
+	uint64_t diff[2];
+	size_t i;
+
+	v = _mm_set_epi64x(val + FT_PATTERN_STEP, val);
+	inc = _mm_set1_epi64x(2 * FT_PATTERN_STEP);
+	acc = _mm_setzero_si128();
+	for (i = 0; i + 2 <= words; i += 2) {
+		acc = _mm_or_si128(acc, _mm_xor_si128(v, _mm_loadu_si128(
+				(const __m128i *) ((const char *) buf + i * 8))));
+		v = _mm_add_epi64(v, inc);
+	}
+	_mm_storeu_si128((__m128i *) diff, acc);
+	return diff[0] | diff[1] |
+		ft_diff_scalar((const char *) buf + i * 8, words - i,
+			       val + i * FT_PATTERN_STEP);
+}
+
+__attribute__((target("avx2")))
+static void ft_fill_avx2(void *buf, size_t words, uint64_t val)
+{
+	__m256i v, inc;
+	size_t i;
+
+	v = _mm256_set_epi64x(val + 3 * FT_PATTERN_STEP,
+			      val + 2 * FT_PATTERN_STEP,
+			      val + FT_PATTERN_STEP, val);
+	inc = _mm256_set1_epi64x(4 * FT_PATTERN_STEP);
+	for (i = 0; i + 4 <= words; i += 4) {
+		_mm256_storeu_si256((__m256i *) ((char *) buf + i * 8), v);
+		v = _mm256_add_epi64(v, inc);
+	}
+	ft_fill_scalar((char *) buf + i * 8, words - i,
+		       val + i * FT_PATTERN_STEP);
+}
+
+__attribute__((target("avx2")))
+static uint64_t ft_diff_avx2(const void *buf, size_t words, uint64_t val)
+{
+	__m256i v, inc, acc;
+	uint64_t diff[4];
+	size_t i;
+
+	v = _mm256_set_epi64x(val + 3 * FT_PATTERN_STEP,
+			      val + 2 * FT_PATTERN_STEP,
+			      val + FT_PATTERN_STEP, val);
+	inc = _mm256_set1_epi64x(4 * FT_PATTERN_STEP);
+	acc = _mm256_setzero_si256();
+	for (i = 0; i + 4 <= words; i += 4) {
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(v, _mm256_loadu_si256(
+				(const __m256i *) ((const char *) buf + i * 8))));
+		v = _mm256_add_epi64(v, inc);
+	}
+	_mm256_storeu_si256((__m256i *) diff, acc);
+	return diff[0] | diff[1] | diff[2] | diff[3] |
+		ft_diff_scalar((const char *) buf + i * 8, words - i,
+			       val + i * FT_PATTERN_STEP);
+}
+#endif
+
+static void (*ft_fill_words)(void *buf, size_t words, uint64_t val);
+static uint64_t (*ft_diff_words)(const void *buf, size_t words, uint64_t val);
+static const char *ft_verify_kernel = "scalar";
+
+static void ft_verify_init(void)
+{
+	ft_fill_words = ft_fill_scalar;
+	ft_diff_words = ft_diff_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		ft_fill_words = ft_fill_avx2;
+		ft_diff_words = ft_diff_avx2;
+		ft_verify_kernel = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		ft_fill_words = ft_fill_sse2;
+		ft_diff_words = ft_diff_sse2;
+		ft_verify_kernel = "sse2";
+	}
+#endif
+}
+
+/* The sender's role is part of the seed, so an echo never matches itself */
+static uint64_t ft_pattern_base(uint64_t seq, int client)
+{
+	return ((seq << 1 | !!client) + 1) * FT_PATTERN_MUL;
+}
+
+void ft_fill_buf(void *buf, size_t size, uint64_t seq, int client)
+{
+	size_t words = size / 8;
+	uint64_t tail;
+
+	if (!ft_fill_words)
+		ft_verify_init();
+
+	ft_fill_words(buf, words, ft_pattern_base(seq, client));
+	if (size % 8) {
+		tail = ft_pattern_base(seq, client) + words * FT_PATTERN_STEP;
+		memcpy((char *) buf + words * 8, &tail, size % 8);
+	}
+}
+
+int ft_check_buf(void *buf, size_t size, uint64_t seq, int client)
+{
+	size_t words = size / 8, i;
+	uint64_t diff, tail;
+	uint8_t *expect;
+
+	if (!ft_diff_words)
+		ft_verify_init();
+
+	diff = ft_diff_words(buf, words, ft_pattern_base(seq, client));
+	if (size % 8) {
+		tail = ft_pattern_base(seq, client) + words * FT_PATTERN_STEP;
+		diff |= memcmp((char *) buf + words * 8, &tail, size % 8);
+	}
+	if (!diff)
+		return 0;
+
+	expect = malloc(size);
+	if (expect) {
+		ft_fill_buf(expect, size, seq, client);
+		for (i = 0; i < size && ((uint8_t *) buf)[i] == expect[i]; i++)
+			;
+		fprintf(stderr, "payload mismatch in message %llu of %zu bytes "
+			"at offset %zu: expected 0x%02x, got 0x%02x\n",
+			(unsigned long long) seq, size, i, expect[i],
+			((uint8_t *) buf)[i]);
+		free(expect);
+	} else {
+		fprintf(stderr, "payload mismatch in message %llu of %zu bytes\n",
+			(unsigned long long) seq, size);
+	}
+	return -FI_EIO;
+}
+
+void ft_verify_fill_buf(void *buf, size_t size, int client)
+{
+	uint64_t start, ticks;
+
+	start = ft_timer_ticks();
+	ft_fill_buf(buf, size, ft_verify.tx_seq++, client);
+	ticks = ft_timer_ticks() - start;
+	ft_verify.ticks += ticks;
+	ft_verify.lap += ticks;
+}
+
+int ft_verify_check_buf(void *buf, size_t size, int client)
+{
+	uint64_t start, ticks;
+	int ret;
+
+	start = ft_timer_ticks();
+	ret = ft_check_buf(buf, size, ft_verify.rx_seq++, client);
+	ticks = ft_timer_ticks() - start;
+	ft_verify.ticks += ticks;
+	ft_verify.lap += ticks;
+	return ret;
+}
+
+struct ft_trace_ring {
+	struct ft_trace_ring *next;
+	uint32_t tid;
+	int stalled;
+	uint64_t head;
+	struct ft_trace_rec rec[FT_TRACE_RING_SIZE];
+};
+
+int ft_trace_enabled;
+static char *ft_trace_path;
+static struct ft_trace_ring *ft_trace_rings;
+static __thread struct ft_trace_ring *ft_trace_ring;
+
+static struct ft_trace_ring *ft_trace_ring_alloc(void)
+{
+	struct ft_trace_ring *ring;
+
+	ring = calloc(1, sizeof *ring);
+	if (!ring) {
+		ft_trace_enabled = 0;
+		return NULL;
+	}
+
+#ifdef __linux__
+	ring->tid = (uint32_t) syscall(SYS_gettid);
+#else
+	ring->tid = (uint32_t) getpid();
+#endif
+	do {
+		ring->next = ft_trace_rings;
+	} while (!__sync_bool_compare_and_swap(&ft_trace_rings, ring->next,
+					       ring));
+	return ring;
+}
+
+void ft_trace_rec(enum ft_trace_type type, enum ft_trace_dir dir,
+		  uint32_t arg)
+{
+	struct ft_trace_ring *ring = ft_trace_ring;
+	struct ft_trace_rec *rec;
+
+	if (!ring) {
+		ring = ft_trace_ring = ft_trace_ring_alloc();
+		if (!ring)
+			return;
+	}
+
+	/* Only the first of a run of empty CQ polls is recorded. */
+	if (type == FT_TRACE_EAGAIN && dir == FT_TRACE_ANY) {
+		if (ring->stalled)
+			return;
+		ring->stalled = 1;
+	} else if (type == FT_TRACE_COMP) {
+		ring->stalled = 0;
+	}
+
+	rec = &ring->rec[ring->head++ & (FT_TRACE_RING_SIZE - 1)];
+	rec->ticks = ft_timer_ticks();
+	rec->arg = arg;
+	rec->type = type;
+	rec->dir = dir;
+}
+
+static void ft_trace_dump(void)
+{
+	struct ft_trace_hdr hdr = { .magic = FT_TRACE_MAGIC,
+				    .version = FT_TRACE_VERSION };
+	struct ft_trace_thread thread;
+	struct ft_trace_ring *ring;
+	char path[PATH_MAX];
+	uint64_t first, i;
+	FILE *file;
+
+	if (!ft_trace_path)
+		return;
+
+	if (ft_pair_idx) {
+		snprintf(path, sizeof path, "%s.%d", ft_trace_path,
+			 ft_pair_idx);
+	} else {
+		snprintf(path, sizeof path, "%s", ft_trace_path);
+	}
+
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		return;
+	}
+
+	for (ring = ft_trace_rings; ring; ring = ring->next)
+		hdr.threads++;
+	hdr.ns_per_tick = ft_timer.ns_per_tick;
+	fwrite(&hdr, sizeof hdr, 1, file);
+
+	for (ring = ft_trace_rings; ring; ring = ring->next) {
+		first = ring->head > FT_TRACE_RING_SIZE ?
+			ring->head - FT_TRACE_RING_SIZE : 0;
+		thread.tid = ring->tid;
+		thread.cnt = (uint32_t) (ring->head - first);
+		thread.dropped = first;
+		fwrite(&thread, sizeof thread, 1, file);
+		for (i = first; i < ring->head; i++) {
+			fwrite(&ring->rec[i & (FT_TRACE_RING_SIZE - 1)],
+			       sizeof(struct ft_trace_rec), 1, file);
+		}
+	}
+
+	if (fclose(file))
+		perror(path);
 }
 
-char *cnt_str(char str[FT_STR_LEN], long long cnt)
+/* Enables tracing; the rings are written to path when the process exits. */
+int ft_trace_init(const char *path)
 {
-	if (cnt >= 1000000000)
-		snprintf(str, FT_STR_LEN, "%lldb", cnt / 1000000000);
-	else if (cnt >= 1000000)
-		snprintf(str, FT_STR_LEN, "%lldm", cnt / 1000000);
-	else if (cnt >= 1000)
-		snprintf(str, FT_STR_LEN, "%lldk", cnt / 1000);
-	else
-		snprintf(str, FT_STR_LEN, "%lld", cnt);
+	if (ft_trace_path)
+		return 0;
 
-	return str;
+	ft_trace_path = strdup(path);
+	if (!ft_trace_path)
+		return -FI_ENOMEM;
+
+	ft_trace_enabled = 1;
+	return atexit(ft_trace_dump) ? -FI_ENOMEM : 0;
 }
 
-int size_to_count(int size)
+static int ft_show_placement(struct cs_opts *opts)
 {
-	if (size >= (1 << 20))
-		return 100;
-	else if (size >= (1 << 16))
-		return 1000;
-	else if (size >= (1 << 10))
-		return 10000;
-	else
-		return 100000;
+	return opts->cpus || opts->mem_node >= 0 ||
+		opts->buf_type != FT_BUF_PAGE;
 }
 
-void init_test(struct cs_opts *opts, char *test_name, size_t test_name_len)
+/* Per-transfer latency in usec, derived from a per-iteration sample. */
+static double ft_hist_usec(uint64_t nsec, int xfers_per_iter)
 {
-	char sstr[FT_STR_LEN];
-
-	size_str(sstr, opts->transfer_size);
-	snprintf(test_name, test_name_len, "%s_lat", sstr);
-	if (!(opts->user_options & FT_OPT_ITER))
-		opts->iterations = size_to_count(opts->transfer_size);
+	return (double) nsec / 1000.0 / xfers_per_iter;
 }
 
-int wait_for_data_completion(struct fid_cq *cq, int num_completions)
+static double ft_cq_per_read(void)
 {
-	int ret;
-	struct fi_cq_data_entry comp;
-
-	while (num_completions > 0) {
-		ret = fi_cq_read(cq, &comp, 1);
-		if (ret > 0) {
-			num_completions--;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(cq, "cq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	}
-	return 0;
+	return ft_cq_stats.hits ?
+		(double) ft_cq_stats.entries / ft_cq_stats.hits : 0.0;
 }
 
-int wait_for_completion(struct fid_cq *cq, int num_completions)
+static double ft_cq_eagain(void)
 {
-	int ret;
-	struct fi_cq_entry comp;
+	return ft_cq_stats.reads ?
+		(double) ft_cq_stats.empty / ft_cq_stats.reads : 0.0;
+}
 
-	while (num_completions > 0) {
-		ret = fi_cq_read(cq, &comp, 1);
-		if (ret > 0) {
-			num_completions--;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(cq, "cq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	}
-	return 0;
+/* CPU time of the timed iterations as a percentage of their wall time. */
+static double ft_cpu_util(struct ft_trials *trials)
+{
+	return trials->elapsed ? (trials->utime + trials->stime) *
+		100000.0 / trials->elapsed : 0.0;
 }
 
-void cq_readerr(struct fid_cq *cq, char *cq_str)
-{ 
-	struct fi_cq_err_entry cq_err;
-	const char *err_str;
-	int ret;
+static double ft_cpu_per_xfer(struct ft_trials *trials, int xfers_per_iter)
+{
+	return (double) (trials->utime + trials->stime) /
+		trials->iters / xfers_per_iter;
+}
 
-	ret = fi_cq_readerr(cq, &cq_err, 0);
-	if (ret < 0)
-		FT_PRINTERR("fi_cq_readerr", ret);
+static double ft_hw_per_xfer(struct ft_trials *trials, uint64_t cnt,
+			     int xfers_per_iter)
+{
+	return (double) cnt / trials->iters / xfers_per_iter;
+}
 
-	err_str = fi_cq_strerror(cq, cq_err.prov_errno, cq_err.err_data, NULL, 0);
-	fprintf(stderr, "%s %s (%d)\n", cq_str, err_str, cq_err.prov_errno);
+static double ft_verify_per_xfer(struct ft_trials *trials, int xfers_per_iter)
+{
+	return (double) trials->verify / 1000.0 / trials->iters / xfers_per_iter;
 }
 
-int ft_finalize(struct fid_ep *tx_ep, struct fid_cq *scq, struct fid_cq *rcq,
-		fi_addr_t addr)
+/*
+ * Aggregate results of all pairs.  fairness is Jain's index of the per-pair
+ * message rates: 1 when all pairs got the same rate, 1 / pairs when one
+ * pair got everything.
+ */
+struct ft_pairs_sum {
+	int cnt;
+	double gbps;
+	double msg_rate;
+	double min_rate;
+	double max_rate;
+	double fairness;
+};
+
+static int ft_pairs_sum(int tsize, int xfers_per_iter, struct ft_pairs_sum *sum)
 {
-	struct fi_msg msg;
-	struct iovec iov;
-	struct fi_context tx_ctx;
-	char buf[4] = "fin";
-	int ret;
+	struct ft_trials *trials;
+	double rate, sq = 0;
+	int i;
 
-	iov.iov_base = buf;
-	iov.iov_len = sizeof buf;
-	msg.msg_iov = &iov;
-	msg.desc = NULL;
-	msg.iov_count = 1;
-	msg.addr = addr;
-	msg.context = &tx_ctx;
-	msg.data = 0;
+	if (!ft_pairs || ft_pair_idx)
+		return 0;
 
-	ret = fi_sendmsg(tx_ep, &msg, FI_INJECT | FI_REMOTE_COMPLETE);
-	if (ret) {
-		FT_PRINTERR("fi_sendmsg", ret);
-		return ret;
+	memset(sum, 0, sizeof *sum);
+	for (i = 0; i < ft_pairs->cnt; i++) {
+		trials = &ft_pairs->trials[i];
+		if (!trials->elapsed)
+			continue;
+
+		rate = (double) trials->iters * xfers_per_iter * 1000000000.0 /
+			trials->elapsed;
+		if (!sum->cnt || rate < sum->min_rate)
+			sum->min_rate = rate;
+		if (rate > sum->max_rate)
+			sum->max_rate = rate;
+		sum->msg_rate += rate;
+		sq += rate * rate;
+		sum->cnt++;
 	}
+	if (!sum->cnt)
+		return 0;
 
-	wait_for_data_completion(scq, 1);
-	wait_for_data_completion(rcq, 1);
-	return 0;
+	sum->gbps = sum->msg_rate * tsize * 8 / 1000000000.0;
+	sum->fairness = sum->msg_rate * sum->msg_rate / (sum->cnt * sq);
+	return 1;
 }
 
-int64_t get_elapsed(const struct timespec *b, const struct timespec *a,
-		    enum precision p)
+static void show_setup(void)
 {
-    int64_t elapsed;
+	uint64_t total = ft_setup_total();
+	int i;
 
-    elapsed = (a->tv_sec - b->tv_sec) * 1000 * 1000 * 1000;
-    elapsed += a->tv_nsec - b->tv_nsec;
-    return elapsed / p;
+	if (!total)
+		return;
+
+	printf("# %-14s%6s%12s%8s\n", "setup", "calls", "usec", "%");
+	for (i = 0; i < FT_SETUP_MAX; i++) {
+		if (!ft_setup[i].calls)
+			continue;
+		printf("# %-14s%6d%12.1f%7.1f%%\n", ft_setup_name[i],
+			ft_setup[i].calls, ft_setup[i].nsec / 1000.0,
+			ft_setup[i].nsec * 100.0 / total);
+	}
+	printf("# %-14s%6s%12.1f\n", "total", "", total / 1000.0);
 }
 
-void show_perf(char *name, int tsize, int iters, struct timespec *start, 
-		struct timespec *end, int xfers_per_iter)
+static const double ft_hist_pct[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char *ft_hist_pct_name[] = { "p50", "p90", "p99", "p99.9" };
+
+static void show_perf(struct cs_opts *opts, char *name, int tsize,
+		      int xfers_per_iter, struct ft_hist *hist,
+		      struct ft_trials *trials)
 {
 	static int header = 1;
-	char str[FT_STR_LEN];
-	int64_t elapsed = get_elapsed(start, end, MICRO);
-	long long bytes = (long long) iters * tsize * xfers_per_iter;
+	char str[FT_STR_LEN], cpus[FT_CPUS_LEN];
+	struct ft_pairs_sum sum;
+	double elapsed = trials->elapsed;
+	long long bytes = (long long) trials->iters * tsize * xfers_per_iter;
+	int i;
 
 	if (header) {
-		printf("%-10s%-8s%-8s%-8s%8s %10s%13s\n",
+		show_setup();
+		if (hist) {
+			printf("# timer: %s, %.3f ns/tick, overhead %llu ns\n",
+				ft_timer_str(ft_timer.type), ft_timer.ns_per_tick,
+				(unsigned long long) ft_timer.overhead);
+		}
+		if (ft_show_placement(opts)) {
+			printf("# placement: cpus %s, cpu %d, mem node %d, "
+				"buffers %s\n", ft_cpus_str(cpus, sizeof cpus),
+				ft_cur_cpu(), ft_buf_node,
+				ft_buf_str(opts->buf_type));
+		}
+		if (ft_cq_wait_mode == FT_CQ_SPIN_BLOCK) {
+			printf("# cq wait: spin %d usec, then block\n",
+				ft_cq_spin_usec);
+		} else if (ft_cq_wait_mode == FT_CQ_BLOCK) {
+			printf("# cq wait: block\n");
+		}
+		if (opts->verify)
+			printf("# verify: %s\n", ft_verify_kernel);
+		printf("%-10s%-8s%-8s%-8s%8s %10s%13s",
 			"name", "bytes", "iters", "total", "time", "Gb/sec", "usec/xfer");
+		if (trials->offered)
+			printf("%10s%10s", "offered", "msg/sec");
+		if (trials->cnt > 1)
+			printf("%10s%10s", "stddev", "ci95");
+		printf("%10s%8s%8s", "comp/read", "eagain", "cpu");
+		if (ft_peer_valid)
+			printf("%10s", "peer cpu");
+		if (trials->perf)
+			printf("%10s%10s", "cyc/xfer", "ins/xfer");
+		if (opts->verify)
+			printf("%10s", "verify");
+		if (hist) {
+			printf("%10s", "min");
+			for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++)
+				printf("%10s", ft_hist_pct_name[i]);
+			printf("%10s", "max");
+		}
+		printf("\n");
 		header = 0;
 	}
 
@@ -285,21 +2435,74 @@ void show_perf(char *name, int tsize, int iters, struct timespec *start,
 
 	printf("%-8s", size_str(str, tsize));
 
-	printf("%-8s", cnt_str(str, iters));
+	printf("%-8s", cnt_str(str, trials->iters));
 
 	printf("%-8s", size_str(str, bytes));
 
-	printf("%8.2fs%10.2f%11.2f\n",
-		elapsed / 1000000.0, (bytes * 8) / (1000.0 * elapsed),
-		((float)elapsed / iters / xfers_per_iter));
+	printf("%8.2fs", elapsed / 1000000000.0);
+	if (elapsed) {
+		printf("%10.2f%11.2f", bytes * 8 / elapsed,
+			elapsed / 1000.0 / trials->iters / xfers_per_iter);
+	} else {
+		printf("%10s%11s", "-", "-");
+	}
+	if (trials->offered) {
+		printf("%10s", cnt_str(str, (long long) trials->offered));
+		if (elapsed)
+			printf("%10.0f", (double) trials->iters *
+				xfers_per_iter * 1000000000.0 / elapsed);
+		else
+			printf("%10s", "-");
+	}
+
+	if (trials->cnt > 1) {
+		printf("%10.2f%10.2f",
+			ft_trials_stddev(trials) / xfers_per_iter,
+			ft_trials_ci95(trials) / xfers_per_iter);
+	}
+
+	printf("%10.2f%7.1f%%", ft_cq_per_read(), ft_cq_eagain() * 100.0);
+	if (trials->utime || trials->stime)
+		printf("%7.1f%%", ft_cpu_util(trials));
+	else
+		printf("%8s", "-");
+	if (ft_peer_valid)
+		printf("%9.1f%%", ft_cpu_util(&ft_peer_trials));
+	if (trials->perf) {
+		printf("%10.0f%10.0f",
+			ft_hw_per_xfer(trials, trials->hw.cycles, xfers_per_iter),
+			ft_hw_per_xfer(trials, trials->hw.instrs, xfers_per_iter));
+	}
+	if (opts->verify)
+		printf("%10.2f", ft_verify_per_xfer(trials, xfers_per_iter));
+
+	if (hist && hist->count) {
+		printf("%10.2f", ft_hist_usec(hist->min, xfers_per_iter));
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++)
+			printf("%10.2f", ft_hist_usec(ft_hist_percentile(hist,
+				ft_hist_pct[i]), xfers_per_iter));
+		printf("%10.2f", ft_hist_usec(hist->max, xfers_per_iter));
+	}
+	printf("\n");
+
+	if (ft_pairs_sum(tsize, xfers_per_iter, &sum)) {
+		printf("# %d pairs: %.2f Gb/sec, %.3f Mmsg/sec, pair msg/sec "
+			"min %.0f max %.0f, fairness %.3f\n", sum.cnt, sum.gbps,
+			sum.msg_rate / 1000000.0, sum.min_rate, sum.max_rate,
+			sum.fairness);
+	}
 }
 
-void show_perf_mr(int tsize, int iters, struct timespec *start,
-		  struct timespec *end, int xfers_per_iter, int argc, char *argv[])
+static void show_perf_mr(struct cs_opts *opts, int tsize, int xfers_per_iter,
+			 struct ft_hist *hist, struct ft_trials *trials,
+			 int argc, char *argv[])
 {
 	static int header = 1;
-	int64_t elapsed = get_elapsed(start, end, MICRO);
-	long long total = (long long) iters * tsize * xfers_per_iter;
+	char cpus[FT_CPUS_LEN];
+	struct ft_pairs_sum sum;
+	const char *sep;
+	double elapsed = trials->elapsed;
+	long long total = (long long) trials->iters * tsize * xfers_per_iter;
 	int i;
 
 	if (header) {
@@ -309,19 +2512,443 @@ void show_perf_mr(int tsize, int iters, struct timespec *start,
 			printf("%s ", argv[i]);
 
 		printf("\n");
+		if (hist) {
+			printf("# timer: %s, ns_per_tick: %f, overhead_ns: %llu\n",
+				ft_timer_str(ft_timer.type), ft_timer.ns_per_tick,
+				(unsigned long long) ft_timer.overhead);
+		}
+		if (ft_show_placement(opts)) {
+			printf("# placement: cpus: %s, cpu: %d, mem_node: %d, "
+				"buffers: %s\n", ft_cpus_str(cpus, sizeof cpus),
+				ft_cur_cpu(), ft_buf_node,
+				ft_buf_str(opts->buf_type));
+		}
 		header = 0;
 	}
 
 	printf("- { ");
 	printf("xfer_size: %d, ", tsize);
-	printf("iterations: %d, ", iters);
+	printf("iterations: %d, ", trials->iters);
 	printf("total: %lld, ", total);
-	printf("time: %f, ", elapsed / 1000000.0);
-	printf("Gb/sec: %f, ", (total * 8) / (1000.0 * elapsed));
-	printf("usec/xfer: %f", ((float)elapsed / iters / xfers_per_iter));
+	printf("time: %f, ", elapsed / 1000000000.0);
+	if (elapsed) {
+		printf("Gb/sec: %f, ", total * 8 / elapsed);
+		printf("usec/xfer: %f",
+			elapsed / 1000.0 / trials->iters / xfers_per_iter);
+	} else {
+		printf("Gb/sec: null, usec/xfer: null");
+	}
+	if (trials->cnt > 1) {
+		printf(", trials: %d", trials->cnt);
+		printf(", usec/xfer_stddev: %f",
+			ft_trials_stddev(trials) / xfers_per_iter);
+		printf(", usec/xfer_ci95: %f",
+			ft_trials_ci95(trials) / xfers_per_iter);
+	}
+	printf(", cq_reads: %llu", (unsigned long long) ft_cq_stats.reads);
+	printf(", cq_comp_per_read: %f", ft_cq_per_read());
+	printf(", cq_empty_polls: %llu", (unsigned long long) ft_cq_stats.empty);
+	printf(", cq_eagain_ratio: %f", ft_cq_eagain());
+	printf(", cq_wait: %s", ft_cq_wait_str());
+	printf(", cq_sreads: %llu", (unsigned long long) ft_cq_stats.sreads);
+	printf(", cpu_user: %f", trials->utime / 1000000.0);
+	printf(", cpu_sys: %f", trials->stime / 1000000.0);
+	printf(", cpu_util: %f", ft_cpu_util(trials));
+	printf(", cpu_usec/xfer: %f", ft_cpu_per_xfer(trials, xfers_per_iter));
+	if (ft_peer_valid) {
+		printf(", peer_cpu_util: %f", ft_cpu_util(&ft_peer_trials));
+		printf(", peer_cpu_usec/xfer: %f",
+			ft_cpu_per_xfer(&ft_peer_trials, xfers_per_iter));
+	}
+	if (ft_setup_total()) {
+		printf(", setup_usec: {");
+		for (i = 0, sep = ""; i < FT_SETUP_MAX; i++) {
+			if (!ft_setup[i].calls)
+				continue;
+			printf("%s%s: %f", sep, ft_setup_name[i],
+				ft_setup[i].nsec / 1000.0);
+			sep = ", ";
+		}
+		printf("%stotal: %f}", sep, ft_setup_total() / 1000.0);
+	}
+	if (trials->perf) {
+		printf(", cycles/xfer: %f", ft_hw_per_xfer(trials,
+			trials->hw.cycles, xfers_per_iter));
+		printf(", instructions/xfer: %f", ft_hw_per_xfer(trials,
+			trials->hw.instrs, xfers_per_iter));
+		printf(", llc_misses/xfer: %f", ft_hw_per_xfer(trials,
+			trials->hw.llc_misses, xfers_per_iter));
+	}
+	if (trials->offered) {
+		printf(", offered_rate: %f", trials->offered);
+		if (elapsed)
+			printf(", msg_rate: %f", (double) trials->iters *
+				xfers_per_iter * 1000000000.0 / elapsed);
+		else
+			printf(", msg_rate: null");
+	}
+	if (opts->verify) {
+		printf(", verify: %s", ft_verify_kernel);
+		printf(", verify_usec/xfer: %f",
+			ft_verify_per_xfer(trials, xfers_per_iter));
+	}
+	if (ft_pairs_sum(tsize, xfers_per_iter, &sum)) {
+		printf(", pairs: %d", sum.cnt);
+		printf(", aggregate_Gb/sec: %f", sum.gbps);
+		printf(", aggregate_msg_rate: %f", sum.msg_rate);
+		printf(", pair_msg_rate_min: %f", sum.min_rate);
+		printf(", pair_msg_rate_max: %f", sum.max_rate);
+		printf(", fairness: %f", sum.fairness);
+	}
+	if (hist && hist->count) {
+		printf(", lat_min: %f", ft_hist_usec(hist->min, xfers_per_iter));
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++)
+			printf(", lat_%s: %f", ft_hist_pct_name[i],
+				ft_hist_usec(ft_hist_percentile(hist,
+				ft_hist_pct[i]), xfers_per_iter));
+		printf(", lat_max: %f", ft_hist_usec(hist->max, xfers_per_iter));
+	}
 	printf(" }\n");
 }
 
+static void ft_json_str(const char *str)
+{
+	putchar('"');
+	for (; str && *str; str++) {
+		switch (*str) {
+		case '"':
+		case '\\':
+			printf("\\%c", *str);
+			break;
+		case '\n':
+			printf("\\n");
+			break;
+		case '\t':
+			printf("\\t");
+			break;
+		default:
+			if ((unsigned char) *str < 0x20)
+				printf("\\u%04x", *str);
+			else
+				putchar(*str);
+			break;
+		}
+	}
+	putchar('"');
+}
+
+static void ft_csv_str(const char *str)
+{
+	putchar('"');
+	for (; str && *str; str++) {
+		if (*str == '"')
+			putchar('"');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+static const char *ft_test_str(int argc, char *argv[])
+{
+	char *slash;
+
+	if (!argc)
+		return "";
+
+	slash = strrchr(argv[0], '/');
+	return slash ? slash + 1 : argv[0];
+}
+
+static const char *ft_prov_str(struct fi_info *info)
+{
+	return (info && info->fabric_attr && info->fabric_attr->prov_name) ?
+		info->fabric_attr->prov_name : "";
+}
+
+static const char *ft_ep_type_str(struct fi_info *info)
+{
+	if (!info || !info->ep_attr)
+		return "";
+
+	return fi_tostr(&info->ep_attr->type, FI_TYPE_EP_TYPE);
+}
+
+static void show_perf_json(struct fi_info *info, char *name, int tsize,
+			   int xfers_per_iter, struct ft_hist *hist,
+			   struct ft_trials *trials, enum ft_buf_type buf_type,
+			   int verify, int argc, char *argv[])
+{
+	char cpus[FT_CPUS_LEN];
+	double elapsed = trials->elapsed;
+	long long total = (long long) trials->iters * tsize * xfers_per_iter;
+	struct ft_pairs_sum sum;
+	int i;
+
+	printf("{\"test\": ");
+	ft_json_str(ft_test_str(argc, argv));
+	printf(", \"name\": ");
+	ft_json_str(name);
+	printf(", \"provider\": ");
+	ft_json_str(ft_prov_str(info));
+	printf(", \"ep_type\": ");
+	ft_json_str(ft_ep_type_str(info));
+	printf(", \"xfer_size\": %d", tsize);
+	printf(", \"iterations\": %d", trials->iters);
+	printf(", \"xfers_per_iter\": %d", xfers_per_iter);
+	printf(", \"total\": %lld", total);
+	printf(", \"time\": %f", elapsed / 1000000000.0);
+	/* an untimed run has no meaningful rate */
+	if (elapsed) {
+		printf(", \"gbps\": %f", total * 8 / elapsed);
+		printf(", \"msg_rate\": %f", (double) trials->iters *
+			xfers_per_iter * 1000000000.0 / elapsed);
+	} else {
+		printf(", \"gbps\": null, \"msg_rate\": null");
+	}
+	if (trials->offered)
+		printf(", \"offered_rate\": %f", trials->offered);
+	if (elapsed)
+		printf(", \"usec_per_xfer\": %f",
+			elapsed / 1000.0 / trials->iters / xfers_per_iter);
+	else
+		printf(", \"usec_per_xfer\": null");
+	printf(", \"trials\": %d", trials->cnt);
+	printf(", \"usec_per_xfer_stddev\": %f",
+		ft_trials_stddev(trials) / xfers_per_iter);
+	printf(", \"usec_per_xfer_ci95\": %f",
+		ft_trials_ci95(trials) / xfers_per_iter);
+	printf(", \"cpus\": ");
+	ft_json_str(ft_cpus_str(cpus, sizeof cpus));
+	printf(", \"cpu\": %d", ft_cur_cpu());
+	printf(", \"mem_node\": %d", ft_buf_node);
+	printf(", \"buffers\": ");
+	ft_json_str(ft_buf_str(buf_type));
+	printf(", \"cq_reads\": %llu", (unsigned long long) ft_cq_stats.reads);
+	printf(", \"cq_comp_per_read\": %f", ft_cq_per_read());
+	printf(", \"cq_empty_polls\": %llu",
+		(unsigned long long) ft_cq_stats.empty);
+	printf(", \"cq_eagain_ratio\": %f", ft_cq_eagain());
+	printf(", \"cq_wait\": ");
+	ft_json_str(ft_cq_wait_str());
+	printf(", \"cq_sreads\": %llu",
+		(unsigned long long) ft_cq_stats.sreads);
+	printf(", \"cpu_user\": %f", trials->utime / 1000000.0);
+	printf(", \"cpu_sys\": %f", trials->stime / 1000000.0);
+	printf(", \"cpu_util\": %f", ft_cpu_util(trials));
+	printf(", \"cpu_usec_per_xfer\": %f",
+		ft_cpu_per_xfer(trials, xfers_per_iter));
+	if (ft_peer_valid) {
+		printf(", \"peer_cpu_util\": %f", ft_cpu_util(&ft_peer_trials));
+		printf(", \"peer_cpu_usec_per_xfer\": %f",
+			ft_cpu_per_xfer(&ft_peer_trials, xfers_per_iter));
+	}
+	if (ft_setup_total()) {
+		printf(", \"setup_usec\": {");
+		for (i = 0; i < FT_SETUP_MAX; i++) {
+			if (!ft_setup[i].calls)
+				continue;
+			printf("\"%s\": %f, ", ft_setup_name[i],
+				ft_setup[i].nsec / 1000.0);
+		}
+		printf("\"total\": %f}", ft_setup_total() / 1000.0);
+	}
+	if (trials->perf) {
+		printf(", \"cycles_per_xfer\": %f", ft_hw_per_xfer(trials,
+			trials->hw.cycles, xfers_per_iter));
+		printf(", \"instructions_per_xfer\": %f", ft_hw_per_xfer(trials,
+			trials->hw.instrs, xfers_per_iter));
+		printf(", \"llc_misses_per_xfer\": %f", ft_hw_per_xfer(trials,
+			trials->hw.llc_misses, xfers_per_iter));
+	}
+	if (verify) {
+		printf(", \"verify\": ");
+		ft_json_str(ft_verify_kernel);
+		printf(", \"verify_usec_per_xfer\": %f",
+			ft_verify_per_xfer(trials, xfers_per_iter));
+	}
+	if (ft_pairs_sum(tsize, xfers_per_iter, &sum)) {
+		printf(", \"pairs\": %d", sum.cnt);
+		printf(", \"aggregate_gbps\": %f", sum.gbps);
+		printf(", \"aggregate_msg_rate\": %f", sum.msg_rate);
+		printf(", \"pair_msg_rate_min\": %f", sum.min_rate);
+		printf(", \"pair_msg_rate_max\": %f", sum.max_rate);
+		printf(", \"fairness\": %f", sum.fairness);
+	}
+
+	if (hist && hist->count) {
+		printf(", \"timer\": ");
+		ft_json_str(ft_timer_str(ft_timer.type));
+		printf(", \"timer_overhead_ns\": %llu",
+			(unsigned long long) ft_timer.overhead);
+		printf(", \"lat_min\": %f",
+			ft_hist_usec(hist->min, xfers_per_iter));
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++) {
+			printf(", \"lat_%s\": %f", ft_hist_pct_name[i],
+				ft_hist_usec(ft_hist_percentile(hist,
+				ft_hist_pct[i]), xfers_per_iter));
+		}
+		printf(", \"lat_max\": %f",
+			ft_hist_usec(hist->max, xfers_per_iter));
+	}
+
+	printf(", \"argv\": [");
+	for (i = 0; i < argc; i++) {
+		if (i)
+			printf(", ");
+		ft_json_str(argv[i]);
+	}
+	printf("]}\n");
+}
+
+static void show_perf_csv(struct fi_info *info, char *name, int tsize,
+			  int xfers_per_iter, struct ft_hist *hist,
+			  struct ft_trials *trials, enum ft_buf_type buf_type,
+			  int verify, int argc, char *argv[])
+{
+	char cpus[FT_CPUS_LEN];
+	static int header = 1;
+	double elapsed = trials->elapsed;
+	long long total = (long long) trials->iters * tsize * xfers_per_iter;
+	struct ft_pairs_sum sum;
+	int i;
+
+	if (header) {
+		printf("test,name,provider,ep_type,xfer_size,iterations,"
+			"xfers_per_iter,total,time,gbps,msg_rate,usec_per_xfer,"
+			"trials,usec_per_xfer_stddev,usec_per_xfer_ci95,"
+			"cpus,cpu,mem_node,buffers,cq_reads,cq_comp_per_read,"
+			"cq_empty_polls,cq_eagain_ratio,cq_wait,cq_sreads,"
+			"cpu_user,cpu_sys,cpu_util,cpu_usec_per_xfer,"
+			"peer_cpu_util,peer_cpu_usec_per_xfer,"
+			"cycles_per_xfer,instructions_per_xfer,"
+			"llc_misses_per_xfer,verify_usec_per_xfer,pairs,"
+			"aggregate_gbps,aggregate_msg_rate,pair_msg_rate_min,"
+			"pair_msg_rate_max,fairness,offered_rate,");
+		for (i = 0; i < FT_SETUP_MAX; i++)
+			printf("setup_%s,", ft_setup_name[i]);
+		printf("setup_total,lat_min");
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++)
+			printf(",lat_%s", ft_hist_pct_name[i]);
+		printf(",lat_max,argv\n");
+		header = 0;
+	}
+
+	ft_csv_str(ft_test_str(argc, argv));
+	putchar(',');
+	ft_csv_str(name);
+	putchar(',');
+	ft_csv_str(ft_prov_str(info));
+	putchar(',');
+	ft_csv_str(ft_ep_type_str(info));
+	printf(",%d,%d,%d,%lld,%f", tsize, trials->iters,
+		xfers_per_iter, total, elapsed / 1000000000.0);
+	if (elapsed) {
+		printf(",%f,%f,%f", total * 8 / elapsed,
+			(double) trials->iters * xfers_per_iter *
+			1000000000.0 / elapsed,
+			elapsed / 1000.0 / trials->iters / xfers_per_iter);
+	} else {
+		printf(",,,");
+	}
+	printf(",%d,%f,%f", trials->cnt,
+		ft_trials_stddev(trials) / xfers_per_iter,
+		ft_trials_ci95(trials) / xfers_per_iter);
+	putchar(',');
+	ft_csv_str(ft_cpus_str(cpus, sizeof cpus));
+	printf(",%d,%d,%s", ft_cur_cpu(), ft_buf_node, ft_buf_str(buf_type));
+	printf(",%llu,%f,%llu,%f", (unsigned long long) ft_cq_stats.reads,
+		ft_cq_per_read(), (unsigned long long) ft_cq_stats.empty,
+		ft_cq_eagain());
+	printf(",%s,%llu,%f,%f,%f,%f", ft_cq_wait_str(),
+		(unsigned long long) ft_cq_stats.sreads,
+		trials->utime / 1000000.0, trials->stime / 1000000.0,
+		ft_cpu_util(trials), ft_cpu_per_xfer(trials, xfers_per_iter));
+	if (ft_peer_valid) {
+		printf(",%f,%f", ft_cpu_util(&ft_peer_trials),
+			ft_cpu_per_xfer(&ft_peer_trials, xfers_per_iter));
+	} else {
+		printf(",,");
+	}
+	if (trials->perf) {
+		printf(",%f,%f,%f",
+			ft_hw_per_xfer(trials, trials->hw.cycles, xfers_per_iter),
+			ft_hw_per_xfer(trials, trials->hw.instrs, xfers_per_iter),
+			ft_hw_per_xfer(trials, trials->hw.llc_misses,
+				       xfers_per_iter));
+	} else {
+		printf(",,,");
+	}
+	if (verify)
+		printf(",%f", ft_verify_per_xfer(trials, xfers_per_iter));
+	else
+		putchar(',');
+	if (ft_pairs_sum(tsize, xfers_per_iter, &sum)) {
+		printf(",%d,%f,%f,%f,%f,%f", sum.cnt, sum.gbps, sum.msg_rate,
+			sum.min_rate, sum.max_rate, sum.fairness);
+	} else {
+		printf(",,,,,,");
+	}
+	if (trials->offered)
+		printf(",%f", trials->offered);
+	else
+		putchar(',');
+	for (i = 0; i < FT_SETUP_MAX; i++)
+		printf(",%f", ft_setup[i].nsec / 1000.0);
+	printf(",%f", ft_setup_total() / 1000.0);
+
+	if (hist && hist->count) {
+		printf(",%f", ft_hist_usec(hist->min, xfers_per_iter));
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct); i++)
+			printf(",%f", ft_hist_usec(ft_hist_percentile(hist,
+				ft_hist_pct[i]), xfers_per_iter));
+		printf(",%f", ft_hist_usec(hist->max, xfers_per_iter));
+	} else {
+		for (i = 0; i < ARRAY_SIZE(ft_hist_pct) + 2; i++)
+			putchar(',');
+	}
+
+	printf(",\"");
+	for (i = 0; i < argc; i++) {
+		const char *c;
+
+		if (i)
+			putchar(' ');
+		for (c = argv[i]; *c; c++) {
+			if (*c == '"')
+				putchar('"');
+			putchar(*c);
+		}
+	}
+	printf("\"\n");
+}
+
+void ft_show_perf(struct cs_opts *opts, struct fi_info *info, char *name,
+		  int tsize, int xfers_per_iter, struct ft_hist *hist,
+		  struct ft_trials *trials)
+{
+	if (!trials->cnt || !trials->iters || ft_pair_idx)
+		return;
+
+	switch (opts->output) {
+	case FT_OUT_YAML:
+		show_perf_mr(opts, tsize, xfers_per_iter, hist, trials,
+			opts->argc, opts->argv);
+		break;
+	case FT_OUT_JSON:
+		show_perf_json(info, name, tsize, xfers_per_iter, hist, trials,
+			opts->buf_type, opts->verify, opts->argc, opts->argv);
+		break;
+	case FT_OUT_CSV:
+		show_perf_csv(info, name, tsize, xfers_per_iter, hist, trials,
+			opts->buf_type, opts->verify, opts->argc, opts->argv);
+		break;
+	default:
+		show_perf(opts, name, tsize, xfers_per_iter, hist, trials);
+		break;
+	}
+	fflush(stdout);
+}
+
 void ft_usage(char *name, char *desc)
 {
 	fprintf(stderr, "Usage:\n");
@@ -358,8 +2985,29 @@ void ft_csusage(char *name, char *desc)
 	fprintf(stderr, "  -f <provider>\tspecific provider name eg sockets, verbs\n");
 	fprintf(stderr, "  -s <address>\tsource address\n");
 	fprintf(stderr, "  -I <number>\tnumber of iterations\n");
-	fprintf(stderr, "  -S <size>\tspecific transfer size or 'all'\n");
-	fprintf(stderr, "  -m\t\tmachine readable output\n");
+	fprintf(stderr, "  -S <sizes>\tspecific transfer size, range (1:4m:x2, 1k:64k:+4k),\n"
+			"\t\tcomma separated list of either, or 'all'\n");
+	fprintf(stderr, "  -w <number>\tnumber of untimed warmup iterations\n");
+	fprintf(stderr, "  -r <number>\tnumber of timed trials per size\n");
+	fprintf(stderr, "  -T <seconds>\ttime budget per message size\n");
+	fprintf(stderr, "  -C <percent>\titerate until the relative stddev of batches is below percent\n");
+	fprintf(stderr, "  -P <cpus>\tpin to a cpu list, e.g. 2 or 0-3,8\n");
+	fprintf(stderr, "  -N <node>\tallocate data buffers on NUMA node\n");
+	fprintf(stderr, "  -B <alloc>\tdata buffers: page (default), malloc, thp or hugetlb\n");
+	fprintf(stderr, "  -Q <number>\tmaximum completions per fi_cq_read call\n");
+	fprintf(stderr, "  -O <port>\tuse a TCP control channel on port for address exchange,\n"
+			"\t\tsynchronization and result collection\n");
+	fprintf(stderr, "  -M <pairs>\trun pairs client/server processes on consecutive ports\n"
+			"\t\tand report their aggregate and fairness\n");
+	fprintf(stderr, "  -R <file>\trecord a binary trace of posts, completions and\n"
+			"\t\tlatencies per thread, written to file at exit\n");
+	fprintf(stderr, "  -W <mode>\twait for completions: busy (default), block, or\n"
+			"\t\tspin[:usec] to poll before blocking (default %d usec)\n",
+			FT_CQ_SPIN_USEC);
+	fprintf(stderr, "  -k\t\tfill sent and check received payloads, timed separately\n");
+	fprintf(stderr, "  -t <timer>\tsample timer: tsc (default) or clock\n");
+	fprintf(stderr, "  -F <format>\toutput format: human, yaml, json or csv\n");
+	fprintf(stderr, "  -m\t\tmachine readable output, same as -F yaml\n");
 	fprintf(stderr, "  -i\t\tprint hints structure and exit\n");
 	fprintf(stderr, "  -v\t\tdisplay versions and exit\n");
 	fprintf(stderr, "  -h\t\tdisplay this help output\n");
@@ -417,6 +3065,8 @@ void ft_parse_addr_opts(int op, char *optarg, struct cs_opts *opts)
 
 void ft_parsecsopts(int op, char *optarg, struct cs_opts *opts)
 {
+	int ret;
+
 	ft_parse_addr_opts(op, optarg, opts);
 
 	switch (op) {
@@ -425,15 +3075,137 @@ void ft_parsecsopts(int op, char *optarg, struct cs_opts *opts)
 		opts->iterations = atoi(optarg);
 		break;
 	case 'S':
-		if (!strncasecmp("all", optarg, 3)) {
-			opts->size_option = 1;
-		} else {
+		free(opts->sizes);
+		if (ft_parse_sizes(optarg, &opts->sizes, &opts->size_cnt)) {
+			fprintf(stderr, "invalid size specification: %s\n",
+				optarg);
+			exit(EXIT_FAILURE);
+		}
+		if (strcasecmp("all", optarg))
 			opts->user_options |= FT_OPT_SIZE;
-			opts->transfer_size = atoi(optarg);
+		opts->transfer_size = opts->sizes[0];
+		break;
+	case 'w':
+		opts->warmup_iterations = atoi(optarg);
+		break;
+	case 'r':
+		opts->repeat = atoi(optarg);
+		if (opts->repeat < 1) {
+			fprintf(stderr, "repeat count must be at least 1\n");
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'T':
+		opts->time_budget = atof(optarg);
+		break;
+	case 'C':
+		opts->converge = atof(optarg);
+		break;
+	case 'P':
+		ret = ft_set_cpus(optarg);
+		if (ret) {
+			fprintf(stderr, "unable to pin to cpus %s: %s\n",
+				optarg, fi_strerror(-ret));
+			exit(EXIT_FAILURE);
+		}
+		opts->cpus = optarg;
+		break;
+	case 'N':
+		opts->mem_node = atoi(optarg);
+		ret = ft_set_mem_node(opts->mem_node);
+		if (ret) {
+			fprintf(stderr, "unable to use memory node %s: %s\n",
+				optarg, fi_strerror(-ret));
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'B':
+		if (!strcasecmp("malloc", optarg)) {
+			opts->buf_type = FT_BUF_MALLOC;
+		} else if (!strcasecmp("page", optarg)) {
+			opts->buf_type = FT_BUF_PAGE;
+		} else if (!strcasecmp("thp", optarg)) {
+			opts->buf_type = FT_BUF_THP;
+		} else if (!strcasecmp("hugetlb", optarg)) {
+			opts->buf_type = FT_BUF_HUGETLB;
+		} else {
+			fprintf(stderr, "unknown buffer allocator: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'Q':
+		ft_cq_batch = atoi(optarg);
+		if (ft_cq_batch < 1 || ft_cq_batch > FT_CQ_BATCH_MAX) {
+			fprintf(stderr, "completion batch must be 1 to %d\n",
+				FT_CQ_BATCH_MAX);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'O':
+		opts->oob_port = optarg;
+		break;
+	case 'R':
+		if (ft_trace_init(optarg)) {
+			fprintf(stderr, "unable to enable tracing\n");
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'M':
+		opts->pairs = atoi(optarg);
+		if (opts->pairs < 1 || opts->pairs > FT_MAX_PAIRS) {
+			fprintf(stderr, "pairs must be 1 to %d\n", FT_MAX_PAIRS);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'W':
+		if (!strcasecmp("busy", optarg)) {
+			ft_cq_wait_mode = FT_CQ_BUSY;
+		} else if (!strcasecmp("block", optarg)) {
+			ft_cq_wait_mode = FT_CQ_BLOCK;
+		} else if (!strncasecmp("spin", optarg, 4) &&
+			   (!optarg[4] || optarg[4] == ':')) {
+			ft_cq_wait_mode = FT_CQ_SPIN_BLOCK;
+			if (optarg[4])
+				ft_cq_spin_usec = atoi(optarg + 5);
+			if (ft_cq_spin_usec < 0) {
+				fprintf(stderr, "spin time must not be negative\n");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			fprintf(stderr, "unknown completion wait mode: %s\n",
+				optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 't':
+		if (!strncasecmp("clock", optarg, 5)) {
+			opts->timer = FT_TIMER_CLOCK;
+		} else if (!strncasecmp("tsc", optarg, 3)) {
+			opts->timer = FT_TIMER_TSC;
+		} else {
+			fprintf(stderr, "unknown timer %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'F':
+		if (!strcasecmp("human", optarg)) {
+			opts->output = FT_OUT_HUMAN;
+		} else if (!strcasecmp("yaml", optarg)) {
+			opts->output = FT_OUT_YAML;
+		} else if (!strcasecmp("json", optarg)) {
+			opts->output = FT_OUT_JSON;
+		} else if (!strcasecmp("csv", optarg)) {
+			opts->output = FT_OUT_CSV;
+		} else {
+			fprintf(stderr, "unknown output format %s\n", optarg);
+			exit(EXIT_FAILURE);
 		}
 		break;
 	case 'm':
-		opts->machr = 1;
+		opts->output = FT_OUT_YAML;
+		break;
+	case 'k':
+		opts->verify = 1;
 		break;
 	case 'i':
 		opts->prhints = 1;
@@ -26,6 +26,8 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,7 +35,9 @@
 #include <time.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
@@ -45,16 +49,20 @@
 
 int listen_sock = -1;
 int sock = -1;
+int is_server;
 static int persistent = 1;
 
 //static struct timespec start, end;
 
 static struct ft_series *series;
 static int test_start_index, test_end_index = INT_MAX;
+static char *size_spec;
+static int window;
 struct ft_info test_info;
 struct fi_info *fabric_info;
 struct ft_xcontrol ft_rx, ft_tx;
 struct ft_control ft;
+struct cs_opts opts;
 
 size_t recv_size, send_size;
 
@@ -68,6 +76,43 @@ enum {
 
 static int results[FT_MAX_RESULT];
 
+/* fi_getinfo results kept for reuse by later tests with the same hints */
+struct ft_info_cache {
+	struct ft_info_cache	*next;
+	struct ft_info		key;
+	uint64_t		flags;
+	struct fi_info		*info;
+};
+
+static struct ft_info_cache *info_cache;
+
+struct ft_setup_sum {
+	uint64_t	nsec;
+	int		calls;
+};
+
+static struct ft_setup_sum series_setup[FT_SETUP_MAX];
+static uint64_t series_nsec;
+
+/*
+ * The server runs each control connection in its own process, and the
+ * client can split the series across several.  Each process owns a slot,
+ * which offsets the service port of its tests, and leaves its counts in
+ * the slot's report for the parent to add up.
+ */
+#define FT_MAX_WORKERS	64
+
+struct ft_fw_report {
+	int			results[FT_MAX_RESULT];
+	struct ft_setup_sum	setup[FT_SETUP_MAX];
+	int			setup_reused[FT_SETUP_MAX];
+};
+
+static struct ft_fw_report *reports;
+static pid_t workers[FT_MAX_WORKERS];
+static int shards = 1, shard, slot, worker;
+static FILE *record_file;
+
 
 static int ft_nullstr(char *str)
 {
@@ -85,6 +130,9 @@ static void ft_show_test_info(void)
 	case FT_TEST_LATENCY:
 		printf("latency");
 		break;
+	case FT_TEST_BANDWIDTH:
+		printf("bandwidth");
+		break;
 	default:
 		break;
 	}
@@ -102,9 +150,33 @@ static void ft_show_test_info(void)
 	case FT_FUNC_SENDMSG:
 		printf(" sendmsg");
 		break;
+	case FT_FUNC_READ:
+		printf(" read");
+		break;
+	case FT_FUNC_READV:
+		printf(" readv");
+		break;
+	case FT_FUNC_READMSG:
+		printf(" readmsg");
+		break;
+	case FT_FUNC_WRITE:
+		printf(" write");
+		break;
+	case FT_FUNC_WRITEV:
+		printf(" writev");
+		break;
+	case FT_FUNC_WRITEMSG:
+		printf(" writemsg");
+		break;
+	case FT_FUNC_WRITEDATA:
+		printf(" writedata");
+		break;
 	default:
 		break;
 	}
+
+	if (test_info.comp_type == FT_COMP_COUNTER)
+		printf(" cntr");
 	printf("\n");
 }
 
@@ -122,142 +194,119 @@ static int ft_check_info(struct fi_info *hints, struct fi_info *info)
 	return 0;
 }
 
-static int ft_fw_listen(char *service)
+static void ft_fw_convert_info(struct fi_info *info, struct ft_info *test_info)
 {
-	struct addrinfo *ai, hints;
-	int val, ret;
-
-	memset(&hints, 0, sizeof hints);
-	hints.ai_flags = AI_PASSIVE;
-
-	ret = getaddrinfo(NULL, service, &hints, &ai);
-	if (ret) {
-		fprintf(stderr, "getaddrinfo() %s\n", gai_strerror(ret));
-		return ret;
-	}
+	info->caps = test_info->caps;
+	info->mode = test_info->mode;
 
-	listen_sock = socket(ai->ai_family, SOCK_STREAM, 0);
-	if (listen_sock < 0) {
-		perror("socket");
-		ret = listen_sock;
-		goto free;
-	}
+	info->ep_attr->type = test_info->ep_type;
+	info->ep_attr->protocol = test_info->protocol;
+	info->ep_attr->protocol_version = test_info->protocol_version;
 
-	val = 1;
-	ret = setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof val);
-	if (ret) {
-		perror("setsockopt SO_REUSEADDR");
-		goto close;
+	if (!ft_nullstr(test_info->prov_name)) {
+		info->fabric_attr->prov_name = strndup(test_info->prov_name,
+					sizeof test_info->prov_name - 1);
 	}
-
-	ret = bind(listen_sock, ai->ai_addr, ai->ai_addrlen);
-	if (ret) {
-		perror("bind");
-		goto close;
+	if (!ft_nullstr(test_info->fabric_name)) {
+		info->fabric_attr->name = strndup(test_info->fabric_name,
+					sizeof test_info->fabric_name - 1);
 	}
+}
 
-	ret = listen(listen_sock, 0);
-	if (ret)
-		perror("listen");
-
-	return 0;
-
-close:
-	close(listen_sock);
-free:
-	freeaddrinfo(ai);
-	return ret;
+static void ft_fw_info_key(struct ft_info *key)
+{
+	memset(key, 0, sizeof *key);
+	key->caps = test_info.caps;
+	key->mode = test_info.mode;
+	key->ep_type = test_info.ep_type;
+	key->protocol = test_info.protocol;
+	key->protocol_version = test_info.protocol_version;
+	strncpy(key->node, test_info.node, sizeof key->node);
+	strncpy(key->service, test_info.service, sizeof key->service);
+	strncpy(key->prov_name, test_info.prov_name, sizeof key->prov_name);
+	strncpy(key->fabric_name, test_info.fabric_name,
+		sizeof key->fabric_name);
 }
 
-static int ft_fw_connect(char *node, char *service)
+/*
+ * Calls fi_getinfo for the current test.  With reuse_domain the result is
+ * cached and returned again for tests that map to the same hints, and must
+ * be released with ft_fw_freeinfo.
+ */
+static int ft_fw_getinfo(struct fi_info *hints, uint64_t flags,
+			 struct fi_info **info)
 {
-	struct addrinfo *ai;
+	struct ft_info_cache *entry;
+	struct ft_info key;
 	int ret;
 
-	ret = getaddrinfo(node, service, NULL, &ai);
-	if (ret) {
-		perror("getaddrinfo");
-		return ret;
-	}
-
-	sock = socket(ai->ai_family, SOCK_STREAM, 0);
-	if (sock < 0) {
-		perror("socket");
-		ret = sock;
-		goto free;
+	if (reuse_domain) {
+		ft_fw_info_key(&key);
+		for (entry = info_cache; entry; entry = entry->next) {
+			if (entry->flags == flags &&
+			    !memcmp(&entry->key, &key, sizeof key)) {
+				setup_reused[FT_SETUP_GETINFO]++;
+				*info = entry->info;
+				return 0;
+			}
+		}
 	}
 
-	ret = 1;
-	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *) &ret, sizeof(ret));
-
-	ret = connect(sock, ai->ai_addr, ai->ai_addrlen);
+	ft_setup_start(FT_SETUP_GETINFO);
+	ret = fi_getinfo(FT_VERSION, ft_strptr(test_info.node),
+			 ft_strptr(test_info.service), flags, hints, info);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
-		perror("connect");
-		close(sock);
+		FT_PRINTERR("fi_getinfo", ret);
+		return ret;
 	}
 
-free:
-	freeaddrinfo(ai);
-	return ret;
-}
+	if (reuse_domain) {
+		entry = calloc(1, sizeof *entry);
+		if (!entry) {
+			fi_freeinfo(*info);
+			return -FI_ENOMEM;
+		}
+		entry->key = key;
+		entry->flags = flags;
+		entry->info = *info;
+		entry->next = info_cache;
+		info_cache = entry;
+	}
 
-static void ft_fw_shutdown(int fd)
-{
-	shutdown(fd, SHUT_RDWR);
-	close(fd);
+	return 0;
 }
 
-int ft_fw_send(int fd, void *msg, size_t len)
+static void ft_fw_freeinfo(struct fi_info *info)
 {
-	int ret;
-
-	ret = send(fd, msg, len, 0);
-	if (ret == len) {
-		return 0;
-	} else if (ret < 0) {
-		perror("send");
-		return -errno;
-	} else {
-		perror("send aborted");
-		return -FI_ECONNABORTED;
-	}
+	if (!reuse_domain)
+		fi_freeinfo(info);
 }
 
-int ft_fw_recv(int fd, void *msg, size_t len)
+static void ft_fw_free_cache(void)
 {
-	int ret;
+	struct ft_info_cache *entry;
 
-	ret = recv(fd, msg, len, MSG_WAITALL);
-	if (ret == len) {
-		return 0;
-	} else if (ret == 0) {
-		return -FI_ENOTCONN;
-	} else if (ret < 0) {
-		perror("recv");
-		return -errno;
-	} else {
-		perror("recv aborted");
-		return -FI_ECONNABORTED;
+	while (info_cache) {
+		entry = info_cache;
+		info_cache = entry->next;
+		fi_freeinfo(entry->info);
+		free(entry);
 	}
 }
 
-static void ft_fw_convert_info(struct fi_info *info, struct ft_info *test_info)
+/* Moves the setup costs of the last test into the series totals. */
+static void ft_fw_add_setup(void)
 {
-	info->caps = test_info->caps;
-	info->mode = test_info->mode;
+	uint64_t nsec;
+	int i, calls;
 
-	info->ep_attr->type = test_info->ep_type;
-	info->ep_attr->protocol = test_info->protocol;
-	info->ep_attr->protocol_version = test_info->protocol_version;
-
-	if (!ft_nullstr(test_info->prov_name)) {
-		info->fabric_attr->prov_name = strndup(test_info->prov_name,
-					sizeof test_info->prov_name - 1);
-	}
-	if (!ft_nullstr(test_info->fabric_name)) {
-		info->fabric_attr->name = strndup(test_info->fabric_name,
-					sizeof test_info->fabric_name - 1);
+	for (i = 0; i < FT_SETUP_MAX; i++) {
+		nsec = ft_setup_nsec(i, &calls);
+		series_setup[i].nsec += nsec;
+		series_setup[i].calls += calls;
 	}
+	ft_setup_reset();
 }
 
 static void
@@ -265,6 +314,11 @@ ft_fw_update_info(struct ft_info *test_info, struct fi_info *info, int subindex)
 {
 	test_info->test_subindex = subindex;
 
+	if (size_spec)
+		strncpy(test_info->sizes, size_spec, sizeof test_info->sizes - 1);
+	if (window)
+		test_info->window = window;
+
 	if (info->ep_attr) {
 		test_info->protocol = info->ep_attr->protocol;
 		test_info->protocol_version = info->ep_attr->protocol_version;
@@ -306,7 +360,7 @@ static int ft_fw_server(void)
 		return -FI_ENOMEM;
 
 	do {
-		ret = ft_fw_recv(sock, &test_info, sizeof test_info);
+		ret = ft_sock_recv(sock, &test_info, sizeof test_info);
 		if (ret) {
 			if (ret == -FI_ENOTCONN)
 				ret = 0;
@@ -317,12 +371,8 @@ static int ft_fw_server(void)
 		printf("Starting test %d-%d: ", test_info.test_index,
 			test_info.test_subindex);
 		ft_show_test_info();
-		ret = fi_getinfo(FT_VERSION, ft_strptr(test_info.node),
-				 ft_strptr(test_info.service), FI_SOURCE,
-				 hints, &info);
-		if (ret) {
-			FT_PRINTERR("fi_getinfo", ret);
-		} else {
+		ret = ft_fw_getinfo(hints, FI_SOURCE, &info);
+		if (!ret) {
 			if (info->next) {
 				printf("fi_getinfo returned multiple matches\n");
 				ret = -FI_E2BIG;
@@ -335,7 +385,7 @@ static int ft_fw_server(void)
 				if (fabric_info != info)
 					fi_freeinfo(fabric_info);
 			}
-			fi_freeinfo(info);
+			ft_fw_freeinfo(info);
 		}
 
 		if (ret) {
@@ -347,7 +397,8 @@ static int ft_fw_server(void)
 		printf("Ending test %d-%d, result: %s\n", test_info.test_index,
 			test_info.test_subindex, fi_strerror(-ret));
 		results[ft_fw_result_index(-ret)]++;
-		ret = ft_fw_send(sock, &ret, sizeof ret);
+		ft_fw_add_setup();
+		ret = ft_sock_send(sock, &ret, sizeof ret);
 	} while (!ret);
 
 	fi_freeinfo(hints);
@@ -357,6 +408,7 @@ static int ft_fw_server(void)
 static int ft_fw_process_list(struct fi_info *hints, struct fi_info *info)
 {
 	int ret, subindex, result, sresult;
+	struct timespec start, end;
 
 	for (subindex = 1, fabric_info = info; fabric_info;
 	     fabric_info = fabric_info->next, subindex++) {
@@ -368,13 +420,17 @@ static int ft_fw_process_list(struct fi_info *hints, struct fi_info *info)
 			return ret;
 
 		ft_fw_update_info(&test_info, fabric_info, subindex);
-		ret = ft_fw_send(sock, &test_info, sizeof test_info);
+		ret = ft_sock_send(sock, &test_info, sizeof test_info);
 		if (ret)
 			return ret;
 
+		ft_record_start();
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		result = ft_run_test();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ft_record_end(result, get_elapsed(&start, &end, NANO));
 
-		ret = ft_fw_recv(sock, &sresult, sizeof sresult);
+		ret = ft_sock_recv(sock, &sresult, sizeof sresult);
 		if (result)
 			return result;
 		else if (ret)
@@ -386,6 +442,21 @@ static int ft_fw_process_list(struct fi_info *hints, struct fi_info *info)
 	return 0;
 }
 
+/* Numeric services are offset by the slot so concurrent tests don't clash */
+static void ft_fw_offset_service(struct ft_info *info)
+{
+	char *end;
+	long port;
+
+	if (!slot || ft_nullstr(info->service))
+		return;
+
+	port = strtol(info->service, &end, 10);
+	if (!*end)
+		snprintf(info->service, sizeof info->service, "%ld",
+			 port + slot);
+}
+
 static int ft_fw_client(void)
 {
 	struct fi_info *hints, *info;
@@ -400,16 +471,17 @@ static int ft_fw_client(void)
 	     fts_next(series)) {
 
 		fts_cur_info(series, &test_info);
+		if ((test_info.test_index - 1) % shards != shard)
+			continue;
+
+		ft_fw_offset_service(&test_info);
 		ft_fw_convert_info(hints, &test_info);
 
 		printf("Starting test %d / %d\n", test_info.test_index, series->test_count);
-		ret = fi_getinfo(FT_VERSION, ft_strptr(test_info.node),
-				 ft_strptr(test_info.service), 0, hints, &info);
-		if (ret) {
-			FT_PRINTERR("fi_getinfo", ret);
-		} else {
+		ret = ft_fw_getinfo(hints, 0, &info);
+		if (!ret) {
 			ret = ft_fw_process_list(hints, info);
-			fi_freeinfo(info);
+			ft_fw_freeinfo(info);
 		}
 
 		if (ret) {
@@ -421,6 +493,7 @@ static int ft_fw_client(void)
 		printf("Ending test %d / %d, result: %s\n",
 			test_info.test_index, series->test_count, fi_strerror(-ret));
 		results[ft_fw_result_index(-ret)]++;
+		ft_fw_add_setup();
 	}
 
 	fi_freeinfo(hints);
@@ -435,11 +508,307 @@ static void ft_fw_show_results(void)
 	printf("ERROR  : %d\n", results[FT_ERROR]);
 }
 
+static int ft_fw_alloc_reports(void)
+{
+	reports = mmap(NULL, FT_MAX_WORKERS * sizeof *reports,
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (reports == MAP_FAILED) {
+		reports = NULL;
+		return -errno;
+	}
+	return 0;
+}
+
+static void ft_fw_save_report(struct ft_fw_report *report)
+{
+	memcpy(report->results, results, sizeof results);
+	memcpy(report->setup, series_setup, sizeof series_setup);
+	memcpy(report->setup_reused, setup_reused, sizeof setup_reused);
+}
+
+static void ft_fw_add_report(struct ft_fw_report *report)
+{
+	int i;
+
+	for (i = 0; i < FT_MAX_RESULT; i++)
+		results[i] += report->results[i];
+
+	for (i = 0; i < FT_SETUP_MAX; i++) {
+		series_setup[i].nsec += report->setup[i].nsec;
+		series_setup[i].calls += report->setup[i].calls;
+		setup_reused[i] += report->setup_reused[i];
+	}
+}
+
+/* Forks a worker for slot i; returns 0 in the worker. */
+static pid_t ft_fw_fork(int i)
+{
+	pid_t pid;
+
+	memset(&reports[i], 0, sizeof reports[i]);
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+	} else if (!pid) {
+		setvbuf(stdout, NULL, _IOLBF, 0);
+		worker = i;
+		ft_perf_init();
+	} else {
+		workers[i] = pid;
+	}
+	return pid;
+}
+
+/*
+ * Waits for a worker to exit and adds its report.  Returns its slot, or
+ * -1 if there was none to wait for without blocking.
+ */
+static int ft_fw_reap(int options, int *ret)
+{
+	int i, status;
+	pid_t pid;
+
+	pid = waitpid(-1, &status, options);
+	if (pid <= 0)
+		return -1;
+
+	for (i = 0; i < FT_MAX_WORKERS && workers[i] != pid; i++)
+		;
+	if (i == FT_MAX_WORKERS)
+		return -1;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "worker %d failed\n", i);
+		*ret = -FI_EOTHER;
+	}
+	ft_fw_add_report(&reports[i]);
+	workers[i] = 0;
+	return i;
+}
+
+static void ft_fw_reap_all(int *ret)
+{
+	int i;
+
+	for (i = 0; i < FT_MAX_WORKERS; i++) {
+		while (workers[i] && ft_fw_reap(0, ret) >= 0)
+			;
+	}
+}
+
+/* Worker exit: release what the series held and leave the report */
+static void ft_fw_exit(int ret)
+{
+	ft_close_control();
+	ft_fw_free_cache();
+	ft_fw_save_report(&reports[worker]);
+	if (record_file && ft_record_save(fileno(record_file)))
+		ret = -FI_EIO;
+	exit(ret ? 1 : 0);
+}
+
+/*
+ * The client tells the server how many shards it runs, and the server
+ * replies with the slot the connection was given.
+ */
+static int ft_fw_connect(char *node, char *service)
+{
+	int ret;
+
+	sock = ft_sock_connect(node, service);
+	if (sock < 0) {
+		fprintf(stderr, "unable to connect to %s:%s: %s\n",
+			node, service, strerror(-sock));
+		return sock;
+	}
+
+	ret = ft_sock_send(sock, &shards, sizeof shards);
+	if (!ret)
+		ret = ft_sock_recv(sock, &slot, sizeof slot);
+	if (ret)
+		ft_sock_shutdown(sock);
+	return ret;
+}
+
+static int ft_fw_run_client(char *node, char *service)
+{
+	int ret;
+	pid_t pid;
+
+	if (shards == 1) {
+		ft_perf_init();
+		ret = ft_fw_connect(node, service);
+		if (ret)
+			return ret;
+
+		ret = ft_fw_client();
+		ft_sock_shutdown(sock);
+		return ret;
+	}
+
+	ret = ft_fw_alloc_reports();
+	if (ret)
+		return ret;
+
+	/* shards append their test records here for the summary */
+	record_file = tmpfile();
+	if (!record_file)
+		return -errno;
+	fcntl(fileno(record_file), F_SETFL, O_APPEND);
+
+	for (shard = 0; shard < shards; shard++) {
+		pid = ft_fw_fork(shard);
+		if (pid < 0) {
+			ret = -errno;
+			break;
+		} else if (!pid) {
+			ret = ft_fw_connect(node, service);
+			if (!ret) {
+				ret = ft_fw_client();
+				ft_sock_shutdown(sock);
+			}
+			ft_fw_exit(ret);
+		}
+	}
+
+	ft_fw_reap_all(&ret);
+	if (ft_record_load(fileno(record_file)) && !ret)
+		ret = -FI_EIO;
+	fclose(record_file);
+	record_file = NULL;
+	return ret;
+}
+
+/*
+ * Each control connection is served by its own process in a free slot.
+ * With -x the server exits once it has served as many connections as the
+ * first client has shards.
+ */
+static int ft_fw_run_server(void)
+{
+	int ret, i, peer_shards, served = 0, expected = 1, err = 0;
+	struct timespec start, end;
+	pid_t pid;
+
+	ret = ft_fw_alloc_reports();
+	if (ret)
+		return ret;
+
+	do {
+		sock = ft_sock_accept(listen_sock);
+		if (sock < 0) {
+			ret = sock;
+			break;
+		}
+		if (!served)
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+		ret = ft_sock_recv(sock, &peer_shards, sizeof peer_shards);
+		if (ret) {
+			ft_sock_shutdown(sock);
+			continue;
+		}
+		if (!served++)
+			expected = peer_shards;
+
+		while (ft_fw_reap(WNOHANG, &err) >= 0)
+			;
+		for (i = 0; i < FT_MAX_WORKERS && workers[i]; i++)
+			;
+		if (i == FT_MAX_WORKERS)
+			i = ft_fw_reap(0, &err);
+		if (i < 0) {
+			ft_sock_shutdown(sock);
+			ret = -FI_EOTHER;
+			break;
+		}
+
+		ret = ft_sock_send(sock, &i, sizeof i);
+		if (ret) {
+			ft_sock_shutdown(sock);
+			continue;
+		}
+
+		pid = ft_fw_fork(i);
+		if (!pid) {
+			close(listen_sock);
+			listen_sock = -1;
+			slot = i;
+			ret = ft_fw_server();
+			ft_sock_shutdown(sock);
+			ft_fw_exit(ret);
+		}
+		close(sock);
+		if (pid < 0) {
+			ret = -errno;
+			break;
+		}
+	} while (persistent || served < expected);
+
+	ft_fw_reap_all(&err);
+	if (served) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		series_nsec += get_elapsed(&start, &end, NANO);
+	}
+	return ret ? ret : err;
+}
+
+/*
+ * Time saved by reuse is estimated from the average cost of the calls of
+ * each kind that were made.
+ */
+static void ft_fw_show_setup(void)
+{
+	uint64_t avg, nsec = 0, saved = 0;
+	int i;
+
+	printf("%-14s%8s%8s%12s%12s%12s\n", "setup", "calls", "reused",
+		"avg_usec", "total_msec", "saved_msec");
+	for (i = 0; i < FT_SETUP_MAX; i++) {
+		if (!series_setup[i].calls)
+			continue;
+
+		avg = series_setup[i].nsec / series_setup[i].calls;
+		printf("%-14s%8d%8d%12.1f%12.3f%12.3f\n", ft_setup_str(i),
+			series_setup[i].calls, setup_reused[i], avg / 1000.0,
+			series_setup[i].nsec / 1000000.0,
+			avg * setup_reused[i] / 1000000.0);
+		nsec += series_setup[i].nsec;
+		saved += avg * setup_reused[i];
+	}
+	printf("Series time: %.3f sec, setup: %.3f sec, "
+		"saved by reuse: %.3f sec (estimated)\n",
+		series_nsec / 1000000000.0, nsec / 1000000000.0,
+		saved / 1000000000.0);
+}
+
+static const struct option longopts[] = {
+	{"shards", required_argument, NULL, 'j'},
+	{0, 0, 0, 0}
+};
+
 static void ft_fw_usage(char *program)
 {
 	printf("usage: %s [server_node]\n", program);
-	printf("\t[-f test_config_file]\n");
+	printf("\t[-f test_config_file]   test sets to run instead of the built-in set\n");
 	printf("\t[-p service_port]\n");
+	printf("\t[-S sizes]   message sizes, e.g. 1:4m:x2 or 1k:64k:+4k\n");
+	printf("\t[-d window]   sends kept outstanding by bandwidth tests (default %d)\n",
+		FT_DEFAULT_CREDITS);
+	printf("\t[-P cpus]   pin to a cpu list, e.g. 2 or 0-3,8\n");
+	printf("\t[-N node]   allocate data buffers on NUMA node\n");
+	printf("\t[-B allocator]   data buffers: page, malloc, thp or hugetlb\n");
+	printf("\t[-Q count]   maximum completions per fi_cq_read call\n");
+	printf("\t[-R trace_file]   record posts, completions and latencies to trace_file\n");
+	printf("\t[-F output_format]   human, yaml, json or csv\n");
+	printf("\t[-T seconds]   latency time budget per message size\n");
+	printf("\t[-C percent]   run latency batches until their relative stddev is below percent\n");
+	printf("\t[-j, --shards count]   split the series across count client processes,\n"
+	       "\t       each with its own control connection and port range\n");
+	printf("\t[-u]   keep the fabric and domain open and reuse fi_getinfo results\n"
+	       "\t       across tests with matching attributes\n");
 	printf("\t[-x]   exit after test run\n");
 	printf("\t[-y start_test_index]\n");
 	printf("\t[-z end_test_index]\n");
@@ -450,9 +819,13 @@ int main(int argc, char **argv)
 	char *node;
 	char *service = "2710";
 	char *filename = NULL;
-	int ret, op;
+	struct timespec start, end;
+	size_t *sizes;
+	int ret, op, size_cnt;
 
-	while ((op = getopt(argc, argv, "f:p:xy:z:")) != -1) {
+	opts = INIT_OPTS;
+	while ((op = getopt_long(argc, argv, "f:p:j:uxy:z:S:d:T:C:P:N:B:Q:R:F:m",
+				 longopts, NULL)) != -1) {
 		switch (op) {
 		case 'f':
 			filename = optarg;
@@ -460,6 +833,17 @@ int main(int argc, char **argv)
 		case 'p':
 			service = optarg;
 			break;
+		case 'j':
+			shards = atoi(optarg);
+			if (shards < 1 || shards > FT_MAX_WORKERS) {
+				fprintf(stderr, "shards must be 1 to %d\n",
+					FT_MAX_WORKERS);
+				exit(1);
+			}
+			break;
+		case 'u':
+			reuse_domain = 1;
+			break;
 		case 'x':
 			persistent = 0;
 			break;
@@ -469,6 +853,34 @@ int main(int argc, char **argv)
 		case 'z':
 			test_end_index = atoi(optarg);
 			break;
+		case 'S':
+			if (strlen(optarg) >= sizeof test_info.sizes ||
+			    ft_parse_sizes(optarg, &sizes, &size_cnt)) {
+				fprintf(stderr, "invalid size specification: %s\n",
+					optarg);
+				exit(1);
+			}
+			free(sizes);
+			size_spec = optarg;
+			break;
+		case 'd':
+			window = atoi(optarg);
+			if (window <= 0) {
+				fprintf(stderr, "invalid window: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'T':
+		case 'C':
+		case 'P':
+		case 'N':
+		case 'B':
+		case 'Q':
+		case 'R':
+		case 'F':
+		case 'm':
+			ft_parsecsopts(op, optarg, &opts);
+			break;
 		default:
 			ft_fw_usage(argv[0]);
 			exit(1);
@@ -481,40 +893,34 @@ int main(int argc, char **argv)
 	}
 
 	node = (optind == argc - 1) ? argv[optind] : NULL;
+	opts.dst_addr = node;
+	ft_timer_init(FT_TIMER_TSC);
 
 	if (node) {
 		series = fts_load(filename);
 		if (!series)
 			exit(1);
 
-		ret = ft_fw_connect(node, service);
-		if (ret)
-			goto out;
-
-		ret = ft_fw_client();
-		ft_fw_shutdown(sock);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = ft_fw_run_client(node, service);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		series_nsec += get_elapsed(&start, &end, NANO);
 	} else {
-		ret = ft_fw_listen(service);
-		if (ret)
+		is_server = 1;
+		listen_sock = ft_sock_listen(service);
+		if (listen_sock < 0) {
+			ret = listen_sock;
 			goto out;
+		}
 
-		do {
-			sock = accept(listen_sock, NULL, 0);
-			if (sock < 0) {
-				ret = sock;
-				perror("accept");
-			}
-
-			op = 1;
-			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
-				   (void *) &op, sizeof(op));
-
-			ret = ft_fw_server();
-			ft_fw_shutdown(sock);
-		} while (persistent);
+		ret = ft_fw_run_server();
 	}
 
+	ft_close_control();
+	ft_fw_free_cache();
 	ft_fw_show_results();
+	ft_fw_show_setup();
+	ft_record_show();
 out:
 	if (node)
 		fts_close(series);
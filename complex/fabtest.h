@@ -49,6 +49,7 @@ extern "C" {
 
 
 extern int listen_sock, sock;
+extern int is_server;
 
 extern struct fid_fabric *fabric;
 extern struct fid_domain *domain;
@@ -57,22 +58,25 @@ extern struct fid_av	 *av;
 //extern struct fid_poll	 *pollset;
 extern struct fid_eq	 *eq;
 extern struct fid_cq	 *txcq, *rxcq;
-//extern struct fid_cntr	 *txcntr, *rxcntr;
+extern struct fid_cntr	 *txcntr, *rxcntr;
 extern struct fid_ep	 *ep;
 extern struct fid_pep	 *pep;
 //extern struct fid_stx	 *stx;
 //extern struct fid_sep	 *sep;
 
+extern int reuse_domain;
+extern int setup_reused[FT_SETUP_MAX];
+
 extern struct ft_info test_info;
 extern struct fi_info *fabric_info;
+extern struct cs_opts opts;
 
 extern size_t sm_size_array[];
-extern size_t med_size_array[];
-extern size_t lg_size_array[];
-extern size_t size_array[];
 extern const unsigned int sm_size_cnt;
-extern const unsigned int med_size_cnt;
-extern const unsigned int lg_size_cnt;
+
+/* Message size sweeps, see ft_parse_sizes() */
+#define FT_MED_SIZES	"16:16k:x2,192:12k:x2"
+#define FT_LG_SIZES	"16:4m:x2,192:6m:x2"
 
 struct ft_xcontrol {
 	struct fid_ep		*ep;
@@ -85,7 +89,9 @@ struct ft_xcontrol {
 	size_t			msg_size;
 	size_t			credits;
 	size_t			max_credits;
+	uint64_t		cntr_val;
 	fi_addr_t		addr;
+	struct fi_rma_iov	rma_iov;    /* peer's RMA target buffer */
 	uint64_t		tag;
 	uint8_t			seqno;
 	enum fi_cq_format	cq_format;
@@ -114,21 +120,21 @@ enum {
 	FT_MAX_AV_TYPES		= 3,
 	FT_MAX_PROV_MODES	= 4,
 	FT_DEFAULT_CREDITS	= 128,
-	FT_COMP_BUF_SIZE	= 256,
-	FT_TIMEOUT		= 15000
+	FT_TIMEOUT		= 15000,
+	FT_RMA_KEY		= 0xC0DE
 };
 
 enum ft_comp_type {
 	FT_COMP_UNSPEC,
 	FT_COMP_QUEUE,
-//	FT_COMP_COUNTER,
+	FT_COMP_COUNTER,
 	FT_MAX_COMP
 };
 
 enum ft_test_type {
 	FT_TEST_UNSPEC,
 	FT_TEST_LATENCY,
-//	FT_TEST_BANDWIDTH,
+	FT_TEST_BANDWIDTH,
 	FT_MAX_TEST
 };
 
@@ -137,9 +143,19 @@ enum ft_class_function {
 	FT_FUNC_SEND,
 	FT_FUNC_SENDV,
 	FT_FUNC_SENDMSG,
+	FT_FUNC_READ,
+	FT_FUNC_READV,
+	FT_FUNC_READMSG,
+	FT_FUNC_WRITE,
+	FT_FUNC_WRITEV,
+	FT_FUNC_WRITEMSG,
+	FT_FUNC_WRITEDATA,
 	FT_MAX_FUNCTIONS
 };
 
+#define ft_rma_func(func) \
+	((func) >= FT_FUNC_READ && (func) <= FT_FUNC_WRITEDATA)
+
 #define FT_FLAG_QUICKTEST	(1ULL << 0)
 
 struct ft_set {
@@ -154,6 +170,9 @@ struct ft_set {
 	uint64_t		mode[FT_MAX_PROV_MODES];
 	uint64_t		caps[FT_MAX_CAPS];
 	uint64_t		test_flags;
+	char			sizes[FI_NAME_MAX];
+	int			iterations;
+	int			window;
 };
 
 struct ft_series {
@@ -188,6 +207,9 @@ struct ft_info {
 	char			service[FI_NAME_MAX];
 	char			prov_name[FI_NAME_MAX];
 	char			fabric_name[FI_NAME_MAX];
+	char			sizes[FI_NAME_MAX];
+	int			iterations;
+	int			window;
 };
 
 
@@ -204,11 +226,10 @@ struct ft_msg {
 	uint8_t		data[124];
 };
 
-int ft_fw_send(int fd, void *msg, size_t len);
-int ft_fw_recv(int fd, void *msg, size_t len);
-
 
 int ft_open_control();
+void ft_reuse_control();
+void ft_close_control();
 ssize_t ft_get_event(uint32_t *event, void *buf, size_t len,
 		     uint32_t event_check, size_t len_check);
 int ft_open_comp();
@@ -233,6 +254,20 @@ int ft_run_test();
 int ft_reset_ep();
 void ft_record_error(int error);
 
+struct ft_size_result {
+	size_t		size;
+	double		usec;		/* per transfer */
+	double		gbps;
+	double		msg_rate;	/* transfers per second */
+};
+
+void ft_record_start(void);
+void ft_record_size(size_t size, int xfers_per_iter, struct ft_trials *trials);
+void ft_record_end(int result, uint64_t nsec);
+int ft_record_save(int fd);
+int ft_record_load(int fd);
+void ft_record_show(void);
+
 
 #ifdef __cplusplus
 }
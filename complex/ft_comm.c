@@ -98,15 +98,17 @@ static int ft_load_av(void)
 	}
 
 	msg.len = (uint32_t) len;
-	ret = ft_fw_send(sock, &msg, sizeof msg);
+	ret = ft_sock_send(sock, &msg, sizeof msg);
 	if (ret)
 		return ret;
 
-	ret = ft_fw_recv(sock, &msg, sizeof msg);
+	ret = ft_sock_recv(sock, &msg, sizeof msg);
 	if (ret)
 		return ret;
 
+	ft_setup_start(FT_SETUP_AV_INSERT);
 	ret = fi_av_insert(av, msg.data, 1, &ft_tx.addr, 0, NULL);
+	ft_setup_end(FT_SETUP_AV_INSERT);
 	if (ret != 1) {
 		FT_PRINTERR("fi_av_insert", ret);
 		return ret;
@@ -115,10 +117,42 @@ static int ft_load_av(void)
 	return 0;
 }
 
-int ft_enable_comm(void)
+/*
+ * Each side tells the other where its receive buffer is registered, so
+ * that it can be the target of RMA transfers.
+ */
+static int ft_exchange_rma_iov(void)
 {
-	if (test_info.ep_type == FI_EP_MSG)
-		return pep ? ft_accept() : ft_connect();
+	struct fi_rma_iov rma_iov;
+	int ret;
+
+	if (fabric_info->domain_attr->mr_mode == FI_MR_SCALABLE)
+		rma_iov.addr = 0;
 	else
-		return ft_load_av();
+		rma_iov.addr = (uintptr_t) ft_rx.buf;
+	rma_iov.len = ft.size_array[ft.size_cnt - 1];
+	rma_iov.key = fi_mr_key(ft_rx.mr);
+
+	ret = ft_sock_send(sock, &rma_iov, sizeof rma_iov);
+	if (ret)
+		return ret;
+
+	return ft_sock_recv(sock, &ft_tx.rma_iov, sizeof ft_tx.rma_iov);
+}
+
+int ft_enable_comm(void)
+{
+	int ret;
+
+	if (test_info.ep_type != FI_EP_MSG) {
+		ret = ft_load_av();
+	} else {
+		ft_setup_start(FT_SETUP_CONNECT);
+		ret = pep ? ft_accept() : ft_connect();
+		ft_setup_end(FT_SETUP_CONNECT);
+	}
+
+	if (!ret && (test_info.caps & FI_RMA))
+		ret = ft_exchange_rma_iov();
+	return ret;
 }
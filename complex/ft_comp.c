@@ -33,25 +33,16 @@
 
 
 struct fid_cq *txcq, *rxcq;
-//struct fid_cntr *txcntr, *rxcntr;
-
-static size_t comp_entry_cnt[] = {
-	[FI_CQ_FORMAT_UNSPEC] = 0,
-	[FI_CQ_FORMAT_CONTEXT] = FT_COMP_BUF_SIZE / sizeof(struct fi_cq_entry),
-	[FI_CQ_FORMAT_MSG] = FT_COMP_BUF_SIZE / sizeof(struct fi_cq_msg_entry),
-	[FI_CQ_FORMAT_DATA] = FT_COMP_BUF_SIZE / sizeof(struct fi_cq_data_entry),
-	[FI_CQ_FORMAT_TAGGED] = FT_COMP_BUF_SIZE / sizeof(struct fi_cq_tagged_entry)
-};
+struct fid_cntr *txcntr, *rxcntr;
 
-/*
+/* Unspecified formats are read into a buffer sized for the largest entry */
 static size_t comp_entry_size[] = {
-	[FI_CQ_FORMAT_UNSPEC] = 0,
+	[FI_CQ_FORMAT_UNSPEC] = sizeof(struct fi_cq_tagged_entry),
 	[FI_CQ_FORMAT_CONTEXT] = sizeof(struct fi_cq_entry),
 	[FI_CQ_FORMAT_MSG] = sizeof(struct fi_cq_msg_entry),
 	[FI_CQ_FORMAT_DATA] = sizeof(struct fi_cq_data_entry),
 	[FI_CQ_FORMAT_TAGGED] = sizeof(struct fi_cq_tagged_entry)
 };
-*/
 
 
 static int ft_open_cqs(void)
@@ -65,7 +56,9 @@ static int ft_open_cqs(void)
 		attr.wait_obj = ft_tx.comp_wait;
 		attr.size = ft_tx.max_credits;
 
+		ft_setup_start(FT_SETUP_CQ);
 		ret = fi_cq_open(domain, &attr, &txcq, NULL);
+		ft_setup_end(FT_SETUP_CQ);
 		if (ret) {
 			FT_PRINTERR("fi_cq_open", ret);
 			return ret;
@@ -78,7 +71,9 @@ static int ft_open_cqs(void)
 		attr.wait_obj = ft_rx.comp_wait;
 		attr.size = ft_rx.max_credits;
 
+		ft_setup_start(FT_SETUP_CQ);
 		ret = fi_cq_open(domain, &attr, &rxcq, NULL);
+		ft_setup_end(FT_SETUP_CQ);
 		if (ret) {
 			FT_PRINTERR("fi_cq_open", ret);
 			return ret;
@@ -88,20 +83,101 @@ static int ft_open_cqs(void)
 	return 0;
 }
 
+static int ft_open_cntrs(void)
+{
+	struct fi_cntr_attr attr;
+	int ret;
+
+	if (!txcntr) {
+		memset(&attr, 0, sizeof attr);
+		attr.events = FI_CNTR_EVENTS_COMP;
+		attr.wait_obj = ft_tx.comp_wait;
+
+		ft_setup_start(FT_SETUP_CNTR);
+		ret = fi_cntr_open(domain, &attr, &txcntr, NULL);
+		ft_setup_end(FT_SETUP_CNTR);
+		if (ret) {
+			FT_PRINTERR("fi_cntr_open", ret);
+			return ret;
+		}
+	}
+
+	if (!rxcntr) {
+		memset(&attr, 0, sizeof attr);
+		attr.events = FI_CNTR_EVENTS_COMP;
+		attr.wait_obj = ft_rx.comp_wait;
+
+		ft_setup_start(FT_SETUP_CNTR);
+		ret = fi_cntr_open(domain, &attr, &rxcntr, NULL);
+		ft_setup_end(FT_SETUP_CNTR);
+		if (ret) {
+			FT_PRINTERR("fi_cntr_open", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 int ft_open_comp(void)
 {
 	int ret;
 
-	ret = (test_info.comp_type == FT_COMP_QUEUE) ?
-		ft_open_cqs() : -FI_ENOSYS;
+	switch (test_info.comp_type) {
+	case FT_COMP_QUEUE:
+		ret = ft_open_cqs();
+		break;
+	case FT_COMP_COUNTER:
+		ret = ft_open_cntrs();
+		break;
+	default:
+		ret = -FI_ENOSYS;
+		break;
+	}
 
 	return ret;
 }
 
+/*
+ * RMA transfers are counted by the initiator's reads and writes, and at
+ * the target by every remote write, which requires FI_RMA_EVENT.
+ */
+static int ft_bind_cntrs(struct fid_ep *ep, uint64_t flags)
+{
+	uint64_t tx_flags = FI_SEND, rx_flags = FI_RECV;
+	int ret;
+
+	if (test_info.caps & FI_RMA) {
+		tx_flags |= FI_READ | FI_WRITE;
+		rx_flags |= FI_REMOTE_WRITE;
+	}
+
+	if (flags & FI_SEND) {
+		ret = fi_ep_bind(ep, &txcntr->fid, tx_flags);
+		if (ret) {
+			FT_PRINTERR("fi_ep_bind", ret);
+			return ret;
+		}
+	}
+
+	if (flags & FI_RECV) {
+		ret = fi_ep_bind(ep, &rxcntr->fid, rx_flags);
+		if (ret) {
+			FT_PRINTERR("fi_ep_bind", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 int ft_bind_comp(struct fid_ep *ep, uint64_t flags)
 {
 	int ret;
 
+	if (test_info.comp_type == FT_COMP_COUNTER)
+		return ft_bind_cntrs(ep, flags);
+
 	if (flags & FI_SEND) {
 		ret = fi_ep_bind(ep, &txcq->fid, flags & ~FI_RECV);
 		if (ret) {
@@ -121,53 +197,72 @@ int ft_bind_comp(struct fid_ep *ep, uint64_t flags)
 	return 0;
 }
 
-int ft_comp_rx(void)
+static int ft_comp_reap(struct fid_cq *cq, enum fi_cq_format format,
+			size_t *credits, char *name)
 {
-	uint8_t buf[FT_COMP_BUF_SIZE];
-	int ret;
+	ssize_t ret;
 
 	do {
-		ret = fi_cq_read(rxcq, buf, comp_entry_cnt[ft_rx.cq_format]);
+		ret = ft_cq_reap(cq, comp_entry_size[format], ft_cq_batch,
+				 NULL, NULL);
 		if (ret < 0) {
-			if (ret == -FI_EAGAIN)
-				break;
-
 			if (ret == -FI_EAVAIL) {
-				cq_readerr(rxcq, "rxcq");
+				cq_readerr(cq, name);
 			} else {
 				FT_PRINTERR("fi_cq_read", ret);
 			}
 			return ret;
-		} else {
-			ft_rx.credits += ret;
 		}
-	} while (ret == comp_entry_cnt[ft_rx.cq_format]);
+		*credits += ret;
+	} while (ret == ft_cq_batch);
 
 	return 0;
 }
 
-
-int ft_comp_tx(void)
+/*
+ * Counters only report how many operations have completed, so the credits
+ * returned are the increase since the last call.  If nothing completed and
+ * the counter has a wait object, block briefly for the next completion.
+ */
+static int ft_comp_cntr(struct fid_cntr *cntr, struct ft_xcontrol *ctrl,
+			char *name)
 {
-	uint8_t buf[FT_COMP_BUF_SIZE];
+	uint64_t val;
 	int ret;
 
-	do {
-		ret = fi_cq_read(txcq, buf, comp_entry_cnt[ft_tx.cq_format]);
-		if (ret < 0) {
-			if (ret == -FI_EAGAIN)
-				break;
-
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(txcq, "txcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
+	val = fi_cntr_read(cntr);
+	if (val == ctrl->cntr_val && ctrl->comp_wait != FI_WAIT_NONE) {
+		ret = fi_cntr_wait(cntr, ctrl->cntr_val + 1, 1);
+		if (ret && ret != -FI_ETIMEDOUT) {
+			FT_PRINTERR("fi_cntr_wait", ret);
 			return ret;
-		} else {
-			ft_tx.credits += ret;
 		}
-	} while (ret == comp_entry_cnt[ft_tx.cq_format]);
+		val = fi_cntr_read(cntr);
+	}
 
+	if (fi_cntr_readerr(cntr)) {
+		fprintf(stderr, "%s: %llu operations completed in error\n",
+			name, (unsigned long long) fi_cntr_readerr(cntr));
+		return -FI_EAVAIL;
+	}
+
+	ctrl->credits += val - ctrl->cntr_val;
+	ctrl->cntr_val = val;
 	return 0;
 }
+
+int ft_comp_rx(void)
+{
+	if (test_info.comp_type == FT_COMP_COUNTER)
+		return ft_comp_cntr(rxcntr, &ft_rx, "rxcntr");
+
+	return ft_comp_reap(rxcq, ft_rx.cq_format, &ft_rx.credits, "rxcq");
+}
+
+int ft_comp_tx(void)
+{
+	if (test_info.comp_type == FT_COMP_COUNTER)
+		return ft_comp_cntr(txcntr, &ft_tx, "txcntr");
+
+	return ft_comp_reap(txcq, ft_tx.cq_format, &ft_tx.credits, "txcq");
+}
@@ -26,6 +26,8 @@
  * SOFTWARE.
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -47,12 +49,20 @@ static struct ft_set test_sets[] = {
 		.service = "2224",
 		.prov_name = "sockets",
 		.test_type = {
-			FT_TEST_LATENCY
+			FT_TEST_LATENCY,
+			FT_TEST_BANDWIDTH
 		},
 		.class_function = {
 			FT_FUNC_SEND,
 			FT_FUNC_SENDV,
-			FT_FUNC_SENDMSG
+			FT_FUNC_SENDMSG,
+			FT_FUNC_READ,
+			FT_FUNC_READV,
+			FT_FUNC_READMSG,
+			FT_FUNC_WRITE,
+			FT_FUNC_WRITEV,
+			FT_FUNC_WRITEMSG,
+			FT_FUNC_WRITEDATA
 		},
 		.ep_type = {
 			FI_EP_MSG,
@@ -64,7 +74,8 @@ static struct ft_set test_sets[] = {
 			FI_AV_MAP
 		},
 		.comp_type = {
-			FT_COMP_QUEUE
+			FT_COMP_QUEUE,
+			FT_COMP_COUNTER
 		},
 		.mode = {
 			FT_MODE_ALL
@@ -72,7 +83,7 @@ static struct ft_set test_sets[] = {
 		.caps = {
 			FT_CAP_MSG,
 			FT_CAP_TAGGED,
-//			FT_CAP_RMA,
+			FT_CAP_RMA,
 //			FT_CAP_ATOMIC
 		},
 		.test_flags = FT_FLAG_QUICKTEST
@@ -94,55 +105,458 @@ size_t sm_size_array[] = {
 };
 const unsigned int sm_size_cnt = (sizeof sm_size_array / sizeof sm_size_array[0]);
 
-size_t med_size_array[] = {
-		1 <<  4,
-		1 <<  5,
-		1 <<  6,
-		1 <<  7, (1 <<  7) + (1 <<  6),
-		1 <<  8, (1 <<  8) + (1 <<  7),
-		1 <<  9, (1 <<  9) + (1 <<  8),
-		1 << 10, (1 << 10) + (1 <<  9),
-		1 << 11, (1 << 11) + (1 << 10),
-		1 << 12, (1 << 12) + (1 << 11),
-		1 << 13, (1 << 13) + (1 << 12),
-		1 << 14
+/*
+ * A configuration file holds one or more test sets, each enclosed in braces.
+ * Keys are the fields of struct ft_set and values the names of constants:
+ *
+ * {
+ *	prov_name: sockets,
+ *	test_type: [FT_TEST_LATENCY, FT_TEST_BANDWIDTH],
+ *	ep_type: [FI_EP_MSG, FI_EP_RDM],
+ *	caps: [FT_CAP_MSG, FI_TAGGED | FI_SEND | FI_RECV],
+ *	sizes: "1:64k:x4",
+ *	iterations: 1000,
+ *	window: 64,
+ * }
+ *
+ * Flags may be or'ed together with '|', and values containing ':' or ','
+ * must be quoted.  '#' starts a comment.  Keys that are not given take
+ * their values from the built-in test set, except test_flags.  RMA class
+ * functions only run with caps that include FI_RMA, and send functions
+ * with caps that include FI_MSG or FI_TAGGED.  RMA tests with counter
+ * completions request FI_RMA_EVENT so that the target counts remote writes.
+ */
+struct fts_sym {
+	const char	*name;
+	uint64_t	val;
 };
-const unsigned int med_size_cnt = (sizeof med_size_array / sizeof med_size_array[0]);
-
-size_t lg_size_array[] = {
-		1 <<  4,
-		1 <<  5,
-		1 <<  6,
-		1 <<  7, (1 <<  7) + (1 <<  6),
-		1 <<  8, (1 <<  8) + (1 <<  7),
-		1 <<  9, (1 <<  9) + (1 <<  8),
-		1 << 10, (1 << 10) + (1 <<  9),
-		1 << 11, (1 << 11) + (1 << 10),
-		1 << 12, (1 << 12) + (1 << 11),
-		1 << 13, (1 << 13) + (1 << 12),
-		1 << 14, (1 << 14) + (1 << 13),
-		1 << 15, (1 << 15) + (1 << 14),
-		1 << 16, (1 << 16) + (1 << 15),
-		1 << 17, (1 << 17) + (1 << 16),
-		1 << 18, (1 << 18) + (1 << 17),
-		1 << 19, (1 << 19) + (1 << 18),
-		1 << 20, (1 << 20) + (1 << 19),
-		1 << 21, (1 << 21) + (1 << 20),
-		1 << 22, (1 << 22) + (1 << 21),
+
+#define FTS_SYM(x)	{ #x, x }
+
+static struct fts_sym test_type_syms[] = {
+	FTS_SYM(FT_TEST_LATENCY),
+	FTS_SYM(FT_TEST_BANDWIDTH),
+	{ NULL }
+};
+
+static struct fts_sym class_function_syms[] = {
+	FTS_SYM(FT_FUNC_SEND),
+	FTS_SYM(FT_FUNC_SENDV),
+	FTS_SYM(FT_FUNC_SENDMSG),
+	FTS_SYM(FT_FUNC_READ),
+	FTS_SYM(FT_FUNC_READV),
+	FTS_SYM(FT_FUNC_READMSG),
+	FTS_SYM(FT_FUNC_WRITE),
+	FTS_SYM(FT_FUNC_WRITEV),
+	FTS_SYM(FT_FUNC_WRITEMSG),
+	FTS_SYM(FT_FUNC_WRITEDATA),
+	{ NULL }
 };
-const unsigned int lg_size_cnt = (sizeof lg_size_array / sizeof lg_size_array[0]);
 
+static struct fts_sym ep_type_syms[] = {
+	FTS_SYM(FI_EP_MSG),
+	FTS_SYM(FI_EP_DGRAM),
+	FTS_SYM(FI_EP_RDM),
+	{ NULL }
+};
+
+static struct fts_sym av_type_syms[] = {
+	FTS_SYM(FI_AV_MAP),
+	FTS_SYM(FI_AV_TABLE),
+	{ NULL }
+};
+
+static struct fts_sym comp_type_syms[] = {
+	FTS_SYM(FT_COMP_QUEUE),
+	FTS_SYM(FT_COMP_COUNTER),
+	{ NULL }
+};
+
+static struct fts_sym mode_syms[] = {
+	FTS_SYM(FI_CONTEXT),
+	FTS_SYM(FI_LOCAL_MR),
+	FTS_SYM(FI_PROV_MR_ATTR),
+	FTS_SYM(FI_MSG_PREFIX),
+	FTS_SYM(FT_MODE_ALL),
+	FTS_SYM(FT_MODE_NONE),
+	{ NULL }
+};
+
+static struct fts_sym caps_syms[] = {
+	FTS_SYM(FI_MSG),
+	FTS_SYM(FI_RMA),
+	FTS_SYM(FI_TAGGED),
+	FTS_SYM(FI_ATOMICS),
+	FTS_SYM(FI_READ),
+	FTS_SYM(FI_WRITE),
+	FTS_SYM(FI_RECV),
+	FTS_SYM(FI_SEND),
+	FTS_SYM(FI_REMOTE_READ),
+	FTS_SYM(FI_REMOTE_WRITE),
+	FTS_SYM(FI_REMOTE_CQ_DATA),
+	FTS_SYM(FI_RMA_EVENT),
+	FTS_SYM(FT_CAP_MSG),
+	FTS_SYM(FT_CAP_TAGGED),
+	FTS_SYM(FT_CAP_RMA),
+	FTS_SYM(FT_CAP_ATOMIC),
+	{ NULL }
+};
+
+static struct fts_sym test_flags_syms[] = {
+	FTS_SYM(FT_FLAG_QUICKTEST),
+	{ NULL }
+};
+
+enum {
+	FTS_EOF = 256,
+	FTS_WORD,
+	FTS_ERROR
+};
+
+struct fts_parser {
+	const char	*file;
+	char		*pos;
+	int		line;
+};
+
+static int fts_error(struct fts_parser *p, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", p->file, p->line, msg,
+		arg ? ": " : "", arg ? arg : "");
+	return -FI_EINVAL;
+}
 
 /*
- * TODO: Parse configuration file.
+ * Returns the next punctuation character, or FTS_WORD with the word in tok.
+ * Unquoted words run to the next delimiter with surrounding blanks removed,
+ * so that flag expressions such as "FI_MSG | FI_SEND" form a single word.
  */
-struct ft_series *fts_load(char *filename)
+static int fts_token(struct fts_parser *p, char *tok, size_t len)
+{
+	size_t n = 0;
+
+	for (;;) {
+		while (isspace(*p->pos)) {
+			if (*p->pos == '\n')
+				p->line++;
+			p->pos++;
+		}
+		if (*p->pos != '#')
+			break;
+		while (*p->pos && *p->pos != '\n')
+			p->pos++;
+	}
+
+	switch (*p->pos) {
+	case '\0':
+		return FTS_EOF;
+	case '{':
+	case '}':
+	case '[':
+	case ']':
+	case ':':
+	case ',':
+		return *p->pos++;
+	case '"':
+		for (p->pos++; *p->pos && *p->pos != '"' && *p->pos != '\n';
+		     p->pos++) {
+			if (n == len - 1)
+				return FTS_ERROR;
+			tok[n++] = *p->pos;
+		}
+		if (*p->pos != '"')
+			return FTS_ERROR;
+		p->pos++;
+		break;
+	default:
+		for (; *p->pos && !strchr("{}[]:,#\"\n", *p->pos); p->pos++) {
+			if (n == len - 1)
+				return FTS_ERROR;
+			tok[n++] = *p->pos;
+		}
+		while (n && isspace(tok[n - 1]))
+			n--;
+		break;
+	}
+
+	tok[n] = '\0';
+	return FTS_WORD;
+}
+
+/* Parses a constant name or number, or several or'ed together if flags. */
+static int fts_parse_val(struct fts_parser *p, struct fts_sym *syms,
+			 int flags, char *str, uint64_t *val)
+{
+	struct fts_sym *sym;
+	char *name, *end, *save;
+
+	if (!flags && strchr(str, '|'))
+		return fts_error(p, "value is not a flag", str);
+
+	*val = 0;
+	for (name = strtok_r(str, "|", &save); name;
+	     name = strtok_r(NULL, "|", &save)) {
+		while (isspace(*name))
+			name++;
+		for (end = name + strlen(name); end > name && isspace(end[-1]);)
+			*--end = '\0';
+
+		for (sym = syms; sym->name && strcmp(sym->name, name); sym++)
+			;
+		if (sym->name) {
+			*val |= sym->val;
+		} else {
+			*val |= strtoull(name, &end, 0);
+			if (!*name || *end)
+				return fts_error(p, "unknown value", name);
+		}
+	}
+
+	return 0;
+}
+
+static int fts_parse_list(struct fts_parser *p, struct fts_sym *syms, int flags,
+			  char (*vals)[FI_NAME_MAX], int cnt, int max,
+			  uint64_t *list)
+{
+	int i, ret;
+
+	if (cnt >= max)
+		return fts_error(p, "too many values", NULL);
+
+	for (i = 0; i < cnt; i++) {
+		ret = fts_parse_val(p, syms, flags, vals[i], &list[i]);
+		if (ret)
+			return ret;
+		if (!list[i])
+			return fts_error(p, "value may not be 0", NULL);
+	}
+	for (; i < max; i++)
+		list[i] = 0;
+
+	return 0;
+}
+
+static int fts_parse_int(struct fts_parser *p, char (*vals)[FI_NAME_MAX],
+			 int cnt, int *val)
 {
-	if (filename)
-		printf("Using static tests. Ignoring config file %s\n", filename);
+	char *end;
 
-	test_series.sets = test_sets;
-	test_series.nsets = sizeof(test_sets) / sizeof(test_sets[0]);
+	if (cnt != 1)
+		return fts_error(p, "expected a single value", NULL);
+
+	*val = (int) strtol(vals[0], &end, 0);
+	if (*end || *val <= 0)
+		return fts_error(p, "expected a positive number", vals[0]);
+
+	return 0;
+}
+
+static int fts_parse_str(struct fts_parser *p, char (*vals)[FI_NAME_MAX],
+			 int cnt, char *str)
+{
+	if (cnt != 1)
+		return fts_error(p, "expected a single value", NULL);
+
+	strcpy(str, vals[0]);
+	return 0;
+}
+
+#define FTS_SET_LIST(field, syms, flags)				\
+	do {								\
+		uint64_t list[ARRAY_SIZE(set->field)];			\
+		int i;							\
+									\
+		ret = fts_parse_list(p, syms, flags, vals, cnt,		\
+				     ARRAY_SIZE(set->field), list);	\
+		for (i = 0; !ret && i < ARRAY_SIZE(set->field); i++)	\
+			set->field[i] = list[i];			\
+	} while (0)
+
+static int fts_set_key(struct fts_parser *p, struct ft_set *set, char *key,
+		       char (*vals)[FI_NAME_MAX], int cnt)
+{
+	size_t *sizes;
+	int ret, size_cnt;
+
+	if (!strcmp(key, "node")) {
+		ret = fts_parse_str(p, vals, cnt, set->node);
+	} else if (!strcmp(key, "service")) {
+		ret = fts_parse_str(p, vals, cnt, set->service);
+	} else if (!strcmp(key, "prov_name")) {
+		ret = fts_parse_str(p, vals, cnt, set->prov_name);
+	} else if (!strcmp(key, "test_type")) {
+		FTS_SET_LIST(test_type, test_type_syms, 0);
+	} else if (!strcmp(key, "class_function")) {
+		FTS_SET_LIST(class_function, class_function_syms, 0);
+	} else if (!strcmp(key, "ep_type")) {
+		FTS_SET_LIST(ep_type, ep_type_syms, 0);
+	} else if (!strcmp(key, "av_type")) {
+		FTS_SET_LIST(av_type, av_type_syms, 0);
+	} else if (!strcmp(key, "comp_type")) {
+		FTS_SET_LIST(comp_type, comp_type_syms, 0);
+	} else if (!strcmp(key, "mode")) {
+		FTS_SET_LIST(mode, mode_syms, 1);
+	} else if (!strcmp(key, "caps")) {
+		FTS_SET_LIST(caps, caps_syms, 1);
+	} else if (!strcmp(key, "test_flags")) {
+		if (cnt != 1)
+			return fts_error(p, "expected a single value", NULL);
+		ret = fts_parse_val(p, test_flags_syms, 1, vals[0],
+				    &set->test_flags);
+	} else if (!strcmp(key, "sizes")) {
+		ret = fts_parse_str(p, vals, cnt, set->sizes);
+		if (!ret && ft_parse_sizes(set->sizes, &sizes, &size_cnt))
+			return fts_error(p, "invalid size specification",
+					 set->sizes);
+		if (!ret)
+			free(sizes);
+	} else if (!strcmp(key, "iterations")) {
+		ret = fts_parse_int(p, vals, cnt, &set->iterations);
+	} else if (!strcmp(key, "window")) {
+		ret = fts_parse_int(p, vals, cnt, &set->window);
+	} else {
+		ret = fts_error(p, "unknown key", key);
+	}
+
+	return ret;
+}
+
+static int fts_parse_set(struct fts_parser *p, struct ft_set *set)
+{
+	char key[FI_NAME_MAX], tok[FI_NAME_MAX];
+	char vals[FT_MAX_CAPS][FI_NAME_MAX];
+	int ret, type, cnt;
+
+	for (;;) {
+		type = fts_token(p, key, sizeof key);
+		if (type == '}')
+			return 0;
+		if (type != FTS_WORD)
+			return fts_error(p, "expected a key", NULL);
+		if (fts_token(p, tok, sizeof tok) != ':')
+			return fts_error(p, "expected ':' after", key);
+
+		type = fts_token(p, vals[0], sizeof vals[0]);
+		if (type == '[') {
+			for (cnt = 0; cnt < FT_MAX_CAPS; ) {
+				type = fts_token(p, vals[cnt], sizeof vals[cnt]);
+				if (type == ']')
+					break;
+				if (type != FTS_WORD)
+					return fts_error(p, "expected a value for",
+							 key);
+				cnt++;
+				type = fts_token(p, tok, sizeof tok);
+				if (type == ']')
+					break;
+				if (type != ',')
+					return fts_error(p, "expected ',' or ']' for",
+							 key);
+			}
+			if (type != ']')
+				return fts_error(p, "too many values for", key);
+		} else if (type == FTS_WORD) {
+			cnt = 1;
+		} else {
+			return fts_error(p, "expected a value for", key);
+		}
+
+		ret = fts_set_key(p, set, key, vals, cnt);
+		if (ret)
+			return ret;
+
+		type = fts_token(p, tok, sizeof tok);
+		if (type == '}')
+			return 0;
+		if (type != ',')
+			return fts_error(p, "expected ',' or '}'", NULL);
+	}
+}
+
+static int fts_parse(struct fts_parser *p, struct ft_series *series)
+{
+	struct ft_set *sets;
+	char tok[FI_NAME_MAX];
+	int ret;
+
+	while ((ret = fts_token(p, tok, sizeof tok)) != FTS_EOF) {
+		if (ret != '{')
+			return fts_error(p, "expected '{'", NULL);
+
+		sets = realloc(series->sets,
+			       (series->nsets + 1) * sizeof *series->sets);
+		if (!sets)
+			return -FI_ENOMEM;
+		series->sets = sets;
+
+		sets[series->nsets] = test_sets[0];
+		sets[series->nsets].test_flags = 0;
+		ret = fts_parse_set(p, &sets[series->nsets]);
+		if (ret)
+			return ret;
+		series->nsets++;
+	}
+
+	return series->nsets ? 0 : fts_error(p, "no test sets", NULL);
+}
+
+static char *fts_read_file(char *filename)
+{
+	char *buf = NULL;
+	FILE *f;
+	long len;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "unable to open %s: %s\n", filename,
+			strerror(errno));
+		return NULL;
+	}
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		goto out;
+
+	buf = malloc(len + 1);
+	if (buf && fread(buf, 1, len, f) != len) {
+		free(buf);
+		buf = NULL;
+	}
+	if (buf)
+		buf[len] = '\0';
+out:
+	if (!buf)
+		fprintf(stderr, "unable to read %s\n", filename);
+	fclose(f);
+	return buf;
+}
+
+struct ft_series *fts_load(char *filename)
+{
+	struct fts_parser parser;
+	char *buf;
+	int ret;
+
+	memset(&test_series, 0, sizeof test_series);
+	if (filename) {
+		buf = fts_read_file(filename);
+		if (!buf)
+			return NULL;
+
+		parser.file = filename;
+		parser.pos = buf;
+		parser.line = 1;
+		ret = fts_parse(&parser, &test_series);
+		free(buf);
+		if (ret) {
+			fts_close(&test_series);
+			return NULL;
+		}
+	} else {
+		test_series.sets = test_sets;
+		test_series.nsets = sizeof(test_sets) / sizeof(test_sets[0]);
+	}
 
 	for (fts_start(&test_series, 0); !fts_end(&test_series, 0);
 	     fts_next(&test_series))
@@ -155,33 +569,31 @@ struct ft_series *fts_load(char *filename)
 
 void fts_close(struct ft_series *series)
 {
+	if (series->sets != test_sets)
+		free(series->sets);
+	series->sets = NULL;
+	series->nsets = 0;
 }
 
-void fts_start(struct ft_series *series, int index)
+/*
+ * Message functions need FI_MSG or FI_TAGGED and RMA functions FI_RMA.
+ * Combinations of the two that don't match are not counted as tests.
+ */
+static int fts_info_is_valid(struct ft_series *series)
 {
-	series->cur_set = 0;
-	series->cur_type = 0;
-	series->cur_ep = 0;
-	series->cur_av = 0;
-	series->cur_comp = 0;
-	series->cur_mode = 0;
-	series->cur_caps = 0;
+	struct ft_set *set = &series->sets[series->cur_set];
+	uint64_t caps = set->caps[series->cur_caps];
 
-	series->test_index = 1;
-	if (index > 1) {
-		for (; !fts_end(series, index - 1); fts_next(series))
-			;
-	}
+	if (ft_rma_func(set->class_function[series->cur_func]))
+		return (caps & FI_RMA) != 0;
+
+	return (caps & (FI_MSG | FI_TAGGED)) != 0;
 }
 
-void fts_next(struct ft_series *series)
+static void fts_advance(struct ft_series *series)
 {
 	struct ft_set *set;
 
-	if (fts_end(series, 0))
-		return;
-
-	series->test_index++;
 	set = &series->sets[series->cur_set];
 
 	if (set->caps[++series->cur_caps])
@@ -213,10 +625,43 @@ void fts_next(struct ft_series *series)
 
 	if (set->test_type[++series->cur_type])
 		return;
+	series->cur_type = 0;
 
 	series->cur_set++;
 }
 
+void fts_start(struct ft_series *series, int index)
+{
+	series->cur_set = 0;
+	series->cur_type = 0;
+	series->cur_func = 0;
+	series->cur_ep = 0;
+	series->cur_av = 0;
+	series->cur_comp = 0;
+	series->cur_mode = 0;
+	series->cur_caps = 0;
+
+	while (!fts_end(series, 0) && !fts_info_is_valid(series))
+		fts_advance(series);
+
+	series->test_index = 1;
+	if (index > 1) {
+		for (; !fts_end(series, index - 1); fts_next(series))
+			;
+	}
+}
+
+void fts_next(struct ft_series *series)
+{
+	if (fts_end(series, 0))
+		return;
+
+	series->test_index++;
+	do {
+		fts_advance(series);
+	} while (!fts_end(series, 0) && !fts_info_is_valid(series));
+}
+
 int fts_end(struct ft_series *series, int index)
 {
 	return (series->cur_set >= series->nsets) ||
@@ -237,13 +682,20 @@ void fts_cur_info(struct ft_series *series, struct ft_info *info)
 	info->class_function = set->class_function[series->cur_func];
 	info->test_flags = set->test_flags;
 	info->caps = set->caps[series->cur_caps];
+	if (info->class_function == FT_FUNC_WRITEDATA)
+		info->caps |= FI_REMOTE_CQ_DATA;
 	info->mode = (set->mode[series->cur_mode] == FT_MODE_NONE) ?
 			0 : set->mode[series->cur_mode];
 	info->ep_type = set->ep_type[series->cur_ep];
 	info->av_type = set->av_type[series->cur_av];
 	info->comp_type = set->comp_type[series->cur_comp];
+	if ((info->caps & FI_RMA) && info->comp_type == FT_COMP_COUNTER)
+		info->caps |= FI_RMA_EVENT;
 
 	memcpy(info->node, set->node, FI_NAME_MAX);
 	memcpy(info->service, set->service, FI_NAME_MAX);
 	memcpy(info->prov_name, set->prov_name, FI_NAME_MAX);
+	memcpy(info->sizes, set->sizes, FI_NAME_MAX);
+	info->iterations = set->iterations;
+	info->window = set->window;
 }
@@ -37,6 +37,12 @@ struct fid_domain *domain;
 struct fid_eq *eq;
 struct fid_av *av;
 
+int reuse_domain;
+int setup_reused[FT_SETUP_MAX];
+
+/* The info the open fabric and domain were created from */
+static struct fi_info *domain_info;
+
 
 static int ft_open_fabric(void)
 {
@@ -51,7 +57,9 @@ static int ft_open_fabric(void)
 		return 0;
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fabric_info->fabric_attr, &fabric, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret)
 		FT_PRINTERR("fi_fabric", ret);
 
@@ -132,11 +140,65 @@ static int ft_open_domain(void)
 		return 0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fabric, fabric_info, &domain, NULL);
-	if (ret)
+	ft_setup_end(FT_SETUP_DOMAIN);
+	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
+		return ret;
+	}
 
-	return ret;
+	domain_info = fi_dupinfo(fabric_info);
+	return domain_info ? 0 : -FI_ENOMEM;
+}
+
+static int ft_streq(const char *a, const char *b)
+{
+	return (!a || !b) ? a == b : !strcmp(a, b);
+}
+
+static int ft_domain_match(struct fi_info *a, struct fi_info *b)
+{
+	return a->caps == b->caps && a->mode == b->mode &&
+	       ft_streq(a->fabric_attr->prov_name, b->fabric_attr->prov_name) &&
+	       ft_streq(a->fabric_attr->name, b->fabric_attr->name) &&
+	       ft_streq(a->domain_attr->name, b->domain_attr->name) &&
+	       a->domain_attr->threading == b->domain_attr->threading &&
+	       a->domain_attr->control_progress ==
+			b->domain_attr->control_progress &&
+	       a->domain_attr->data_progress == b->domain_attr->data_progress;
+}
+
+void ft_close_control(void)
+{
+	if (domain) {
+		fi_close(&domain->fid);
+		domain = NULL;
+	}
+	if (fabric) {
+		fi_close(&fabric->fid);
+		fabric = NULL;
+	}
+	fi_freeinfo(domain_info);
+	domain_info = NULL;
+}
+
+/*
+ * With reuse_domain set the fabric and domain stay open between tests.
+ * The next test keeps them if its provider, fabric, domain and requested
+ * capabilities match the info they were opened with.
+ */
+void ft_reuse_control(void)
+{
+	if (!domain)
+		return;
+
+	if (ft_domain_match(domain_info, fabric_info)) {
+		setup_reused[FT_SETUP_FABRIC]++;
+		setup_reused[FT_SETUP_DOMAIN]++;
+	} else {
+		ft_close_control();
+	}
 }
 
 static int ft_open_av(void)
@@ -150,7 +212,9 @@ static int ft_open_av(void)
 	memset(&attr, 0, sizeof attr);
 	attr.type = test_info.av_type;
 	attr.count = 2;
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(domain, &attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		return ret;
@@ -159,21 +223,37 @@ static int ft_open_av(void)
 	return ret;
 }
 
+/*
+ * With RMA the receive buffer is the target of the peer's transfers, so it
+ * is registered for remote access even without FI_LOCAL_MR.
+ */
 static int ft_setup_xcontrol_bufs(struct ft_xcontrol *ctrl)
 {
+	uint64_t access = 0, key = 0;
+	int rma_target;
 	size_t size;
 	int i, ret;
 
 	size = ft.size_array[ft.size_cnt - 1];
 	if (!ctrl->buf) {
-		ctrl->buf = calloc(1, size);
+		ctrl->buf = ft_alloc_buf(&opts, size);
 		if (!ctrl->buf)
 			return -FI_ENOMEM;
 	}
 
-	if ((fabric_info->mode & FI_LOCAL_MR) && !ctrl->mr) {
+	rma_target = (test_info.caps & FI_RMA) && ctrl == &ft_rx;
+	if (rma_target) {
+		access = FI_REMOTE_READ | FI_REMOTE_WRITE;
+		key = FT_RMA_KEY;
+	} else if (test_info.caps & FI_RMA) {
+		access = FI_READ | FI_WRITE;
+	}
+
+	if (((fabric_info->mode & FI_LOCAL_MR) || rma_target) && !ctrl->mr) {
+		ft_setup_start(FT_SETUP_MR);
 		ret = fi_mr_reg(domain, ctrl->buf, size,
-				0, 0, 0, 0, &ctrl->mr, NULL);
+				access, 0, key, 0, &ctrl->mr, NULL);
+		ft_setup_end(FT_SETUP_MR);
 		if (ret) {
 			FT_PRINTERR("fi_mr_reg", ret);
 			return ret;
@@ -49,7 +49,9 @@ int ft_open_passive(void)
 	if (ret)
 		return ret;
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_passive_ep(fabric, fabric_info, &pep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_passive_ep", ret);
 		return ret;
@@ -85,7 +87,9 @@ int ft_open_active(void)
 	if (ret)
 		return ret;
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(domain, fabric_info, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		return ret;
@@ -112,7 +116,9 @@ int ft_open_active(void)
 		}
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
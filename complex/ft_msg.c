@@ -171,11 +171,90 @@ static int ft_post_tsend(void)
 	return ret;
 }
 
+/*
+ * RMA transfers target the peer's receive buffer, whose location was
+ * exchanged when the endpoints were connected.
+ */
+static int ft_post_rma(void)
+{
+	struct fi_msg_rma msg;
+	struct fi_rma_iov rma_iov;
+	int ret;
+
+	rma_iov.addr = ft_tx.rma_iov.addr;
+	rma_iov.len = ft_tx.msg_size;
+	rma_iov.key = ft_tx.rma_iov.key;
+
+	switch (test_info.class_function) {
+	case FT_FUNC_READ:
+		ret = fi_read(ft_tx.ep, ft_tx.buf, ft_tx.msg_size,
+				ft_tx.memdesc, ft_tx.addr, rma_iov.addr,
+				rma_iov.key, NULL);
+		break;
+	case FT_FUNC_READV:
+		ft_format_iov(ft_tx.iov, ft.iov_array[ft_tx.iov_iter],
+				ft_tx.buf, ft_tx.msg_size);
+		ret = fi_readv(ft_tx.ep, ft_tx.iov, ft_tx.iov_desc,
+				ft.iov_array[ft_tx.iov_iter], ft_tx.addr,
+				rma_iov.addr, rma_iov.key, NULL);
+		ft_next_iov_cnt(&ft_tx, fabric_info->tx_attr->iov_limit);
+		break;
+	case FT_FUNC_WRITEV:
+		ft_format_iov(ft_tx.iov, ft.iov_array[ft_tx.iov_iter],
+				ft_tx.buf, ft_tx.msg_size);
+		ret = fi_writev(ft_tx.ep, ft_tx.iov, ft_tx.iov_desc,
+				ft.iov_array[ft_tx.iov_iter], ft_tx.addr,
+				rma_iov.addr, rma_iov.key, NULL);
+		ft_next_iov_cnt(&ft_tx, fabric_info->tx_attr->iov_limit);
+		break;
+	case FT_FUNC_READMSG:
+	case FT_FUNC_WRITEMSG:
+		ft_format_iov(ft_tx.iov, ft.iov_array[ft_tx.iov_iter],
+				ft_tx.buf, ft_tx.msg_size);
+		msg.msg_iov = ft_tx.iov;
+		msg.desc = ft_tx.iov_desc;
+		msg.iov_count = ft.iov_array[ft_tx.iov_iter];
+		msg.addr = ft_tx.addr;
+		msg.rma_iov = &rma_iov;
+		msg.rma_iov_count = 1;
+		msg.context = NULL;
+		msg.data = 0;
+		if (test_info.class_function == FT_FUNC_READMSG)
+			ret = fi_readmsg(ft_tx.ep, &msg, 0);
+		else
+			ret = fi_writemsg(ft_tx.ep, &msg, 0);
+		ft_next_iov_cnt(&ft_tx, fabric_info->tx_attr->iov_limit);
+		break;
+	case FT_FUNC_WRITEDATA:
+		ret = fi_writedata(ft_tx.ep, ft_tx.buf, ft_tx.msg_size,
+				ft_tx.memdesc, 0, ft_tx.addr,
+				rma_iov.addr, rma_iov.key, NULL);
+		break;
+	default:
+		ret = fi_write(ft_tx.ep, ft_tx.buf, ft_tx.msg_size,
+				ft_tx.memdesc, ft_tx.addr, rma_iov.addr,
+				rma_iov.key, NULL);
+		break;
+	}
+
+	return ret;
+}
+
 int ft_post_recv_bufs(void)
 {
 	int ret;
 
+	/*
+	 * RMA is one-sided; remote CQ data does not consume a receive, so
+	 * its completions return no buffer and are not kept as credits.
+	 */
+	if (!(test_info.caps & (FI_MSG | FI_TAGGED))) {
+		ft_rx.credits = 0;
+		return 0;
+	}
+
 	for (; ft_rx.credits; ft_rx.credits--) {
+		ft_trace(FT_TRACE_POST, FT_TRACE_RX, ft_rx.msg_size);
 		if (test_info.caps & FI_MSG) {
 			ret = ft_post_recv();
 		} else {
@@ -184,8 +263,10 @@ int ft_post_recv_bufs(void)
 				ft_rx.tag++;
 		}
 		if (ret) {
-			if (ret == -FI_EAGAIN)
+			if (ret == -FI_EAGAIN) {
+				ft_trace(FT_TRACE_EAGAIN, FT_TRACE_RX, 0);
 				break;
+			}
 			FT_PRINTERR("recv", ret);
 			return ret;
 		}
@@ -224,7 +305,10 @@ int ft_send_msg(void)
 	}
 
 	ft_tx.credits--;
-	if (test_info.caps & FI_MSG) {
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, ft_tx.msg_size);
+	if (ft_rma_func(test_info.class_function)) {
+		ret = ft_post_rma();
+	} else if (test_info.caps & FI_MSG) {
 		ret = ft_post_send();
 	} else {
 		ret = ft_post_tsend();
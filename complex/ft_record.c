@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2015 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AWV
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fabtest.h"
+
+
+/*
+ * The client keeps a record of every test it runs: the test configuration,
+ * its result and wall time, and the performance at each message size.
+ * These are summarized when the series ends.
+ */
+struct ft_record {
+	struct ft_info		info;
+	int			result;
+	uint64_t		nsec;
+	int			size_cnt;
+	struct ft_size_result	*sizes;
+};
+
+#define FT_RECORD_SLOWEST	10
+
+static struct ft_record *records;
+static int record_cnt, record_max;
+static struct ft_record *cur_record;
+
+
+static const char *ft_test_type_str(enum ft_test_type type)
+{
+	switch (type) {
+	case FT_TEST_LATENCY:
+		return "latency";
+	case FT_TEST_BANDWIDTH:
+		return "bandwidth";
+	default:
+		return "-";
+	}
+}
+
+/* Indexed by class function, starting from FT_FUNC_SEND */
+static const char *func_names[] = {
+	"send", "sendv", "sendmsg",
+	"read", "readv", "readmsg",
+	"write", "writev", "writemsg", "writedata"
+};
+
+static int ft_func_index(struct ft_info *info)
+{
+	if (info->class_function < FT_FUNC_SEND ||
+	    info->class_function >= FT_MAX_FUNCTIONS)
+		return -1;
+
+	return info->class_function - FT_FUNC_SEND;
+}
+
+static const char *ep_names[] = { "msg", "rdm", "dgram" };
+
+static int ft_ep_index(struct ft_info *info)
+{
+	switch (info->ep_type) {
+	case FI_EP_MSG:
+		return 0;
+	case FI_EP_RDM:
+		return 1;
+	case FI_EP_DGRAM:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+static char *ft_record_desc(struct ft_info *info, char *buf, size_t len)
+{
+	int func = ft_func_index(info), ep = ft_ep_index(info);
+
+	snprintf(buf, len, "%s %s %s %s %s", ft_test_type_str(info->test_type),
+		 ep < 0 ? "-" : ep_names[ep],
+		 (info->caps & FI_RMA) ? "rma" :
+		 (info->caps & FI_TAGGED) ? "tagged" : "msg",
+		 func < 0 ? "-" : func_names[func],
+		 info->comp_type == FT_COMP_COUNTER ? "cntr" : "cq");
+	return buf;
+}
+
+static struct ft_record *ft_record_alloc(void)
+{
+	struct ft_record *rec;
+
+	if (record_cnt == record_max) {
+		rec = realloc(records, (record_max + 64) * sizeof *records);
+		if (!rec)
+			return NULL;
+		records = rec;
+		record_max += 64;
+	}
+
+	rec = &records[record_cnt++];
+	memset(rec, 0, sizeof *rec);
+	return rec;
+}
+
+void ft_record_start(void)
+{
+	cur_record = ft_record_alloc();
+	if (cur_record)
+		cur_record->info = test_info;
+}
+
+void ft_record_size(size_t size, int xfers_per_iter, struct ft_trials *trials)
+{
+	struct ft_size_result *res;
+	double xfers;
+
+	if (!cur_record || !trials->elapsed)
+		return;
+
+	res = realloc(cur_record->sizes,
+		      (cur_record->size_cnt + 1) * sizeof *res);
+	if (!res)
+		return;
+	cur_record->sizes = res;
+
+	xfers = (double) trials->iters * xfers_per_iter;
+	res = &res[cur_record->size_cnt++];
+	res->size = size;
+	res->usec = trials->elapsed / 1000.0 / xfers;
+	res->gbps = xfers * size * 8 / trials->elapsed;
+	res->msg_rate = xfers * 1000000000.0 / trials->elapsed;
+}
+
+void ft_record_end(int result, uint64_t nsec)
+{
+	if (!cur_record)
+		return;
+
+	cur_record->result = result;
+	cur_record->nsec = nsec;
+	cur_record = NULL;
+}
+
+/* Appends all records to fd, one write each, for another process to load */
+int ft_record_save(int fd)
+{
+	struct ft_record *rec;
+	size_t len;
+	char *buf;
+	int i, ret = 0;
+
+	for (i = 0; i < record_cnt && !ret; i++) {
+		rec = &records[i];
+		len = sizeof *rec + rec->size_cnt * sizeof *rec->sizes;
+		buf = malloc(len);
+		if (!buf)
+			return -FI_ENOMEM;
+
+		memcpy(buf, rec, sizeof *rec);
+		memcpy(buf + sizeof *rec, rec->sizes,
+		       rec->size_cnt * sizeof *rec->sizes);
+		if (write(fd, buf, len) != len)
+			ret = -FI_EIO;
+		free(buf);
+	}
+
+	return ret;
+}
+
+int ft_record_load(int fd)
+{
+	struct ft_record *rec;
+	size_t len;
+
+	if (lseek(fd, 0, SEEK_SET))
+		return -FI_EIO;
+
+	for (;;) {
+		rec = ft_record_alloc();
+		if (!rec)
+			return -FI_ENOMEM;
+
+		if (read(fd, rec, sizeof *rec) != sizeof *rec) {
+			rec->sizes = NULL;
+			record_cnt--;
+			return 0;
+		}
+
+		/* the saved pointer is meaningless in this process */
+		rec->sizes = NULL;
+		if (!rec->size_cnt)
+			continue;
+
+		len = rec->size_cnt * sizeof *rec->sizes;
+		rec->sizes = malloc(len);
+		if (!rec->sizes || read(fd, rec->sizes, len) != len) {
+			free(rec->sizes);
+			rec->sizes = NULL;
+			record_cnt--;
+			return -FI_EIO;
+		}
+	}
+}
+
+static int ft_record_cmp_time(const void *a, const void *b)
+{
+	const struct ft_record *ra = *(struct ft_record **) a;
+	const struct ft_record *rb = *(struct ft_record **) b;
+
+	return ra->nsec < rb->nsec ? 1 : ra->nsec > rb->nsec ? -1 : 0;
+}
+
+static void ft_record_show_slowest(void)
+{
+	struct ft_record **sorted;
+	char desc[FT_STR_LEN * 4];
+	int i;
+
+	sorted = calloc(record_cnt, sizeof *sorted);
+	if (!sorted)
+		return;
+
+	for (i = 0; i < record_cnt; i++)
+		sorted[i] = &records[i];
+	qsort(sorted, record_cnt, sizeof *sorted, ft_record_cmp_time);
+
+	printf("\nSlowest tests:\n");
+	printf("%-10s%10s  %-10s%s\n", "test", "sec", "result", "configuration");
+	for (i = 0; i < record_cnt && i < FT_RECORD_SLOWEST; i++) {
+		snprintf(desc, sizeof desc, "%d-%d", sorted[i]->info.test_index,
+			 sorted[i]->info.test_subindex);
+		printf("%-10s%10.3f  %-10s", desc, sorted[i]->nsec / 1000000000.0,
+			sorted[i]->result ? fi_strerror(-sorted[i]->result) : "ok");
+		printf("%s\n", ft_record_desc(&sorted[i]->info, desc, sizeof desc));
+	}
+
+	free(sorted);
+}
+
+static int ft_size_cmp(const void *a, const void *b)
+{
+	size_t sa = *(size_t *) a, sb = *(size_t *) b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+/*
+ * Prints the mean latency (usec/xfer) or bandwidth (Gb/sec) of each message
+ * size, with one column per value of the configuration field given by col.
+ * Values that no test of this type ran with are left out.
+ */
+static void ft_record_show_cmp(enum ft_test_type type, const char *by,
+			       int (*col)(struct ft_info *), const char **names,
+			       int ncols)
+{
+	size_t *sizes;
+	double sum, val;
+	int i, j, k, c, cnt, nsizes = 0, max = 0;
+	int *used;
+
+	for (i = 0; i < record_cnt; i++)
+		max += records[i].size_cnt;
+	if (!max)
+		return;
+
+	sizes = calloc(max, sizeof *sizes);
+	used = calloc(ncols, sizeof *used);
+	if (!sizes || !used)
+		goto out;
+
+	for (i = 0; i < record_cnt; i++) {
+		if (records[i].info.test_type != type || records[i].result)
+			continue;
+		for (j = 0; j < records[i].size_cnt; j++)
+			sizes[nsizes++] = records[i].sizes[j].size;
+		c = col(&records[i].info);
+		if (c >= 0 && c < ncols && records[i].size_cnt)
+			used[c] = 1;
+	}
+	qsort(sizes, nsizes, sizeof *sizes, ft_size_cmp);
+	for (i = 0, j = 0; i < nsizes; i++) {
+		if (!j || sizes[j - 1] != sizes[i])
+			sizes[j++] = sizes[i];
+	}
+	nsizes = j;
+	if (!nsizes)
+		goto out;
+
+	printf("\n%s %s by %s:\n", ft_test_type_str(type),
+		type == FT_TEST_LATENCY ? "usec/xfer" : "Gb/sec", by);
+	printf("%-10s", "bytes");
+	for (c = 0; c < ncols; c++) {
+		if (used[c])
+			printf("%12s", names[c]);
+	}
+	printf("\n");
+
+	for (i = 0; i < nsizes; i++) {
+		printf("%-10zu", sizes[i]);
+		for (c = 0; c < ncols; c++) {
+			if (!used[c])
+				continue;
+			for (j = 0, sum = 0, cnt = 0; j < record_cnt; j++) {
+				if (records[j].info.test_type != type ||
+				    records[j].result ||
+				    col(&records[j].info) != c)
+					continue;
+				for (k = 0; k < records[j].size_cnt; k++) {
+					if (records[j].sizes[k].size != sizes[i])
+						continue;
+					val = type == FT_TEST_LATENCY ?
+					      records[j].sizes[k].usec :
+					      records[j].sizes[k].gbps;
+					sum += val;
+					cnt++;
+				}
+			}
+			if (cnt)
+				printf("%12.2f", sum / cnt);
+			else
+				printf("%12s", "-");
+		}
+		printf("\n");
+	}
+out:
+	free(used);
+	free(sizes);
+}
+
+void ft_record_show(void)
+{
+	enum ft_test_type type;
+
+	if (!record_cnt)
+		return;
+
+	ft_record_show_slowest();
+	for (type = FT_TEST_LATENCY; type < FT_MAX_TEST; type++) {
+		ft_record_show_cmp(type, "class function", ft_func_index,
+				   func_names, ARRAY_SIZE(func_names));
+		ft_record_show_cmp(type, "endpoint type", ft_ep_index,
+				   ep_names, ARRAY_SIZE(ep_names));
+	}
+}
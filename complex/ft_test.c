@@ -26,13 +26,16 @@
  * SOFTWARE.
  */
 
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #include "fabtest.h"
 
-static struct timespec start, end;
+static struct ft_hist hist;
+static struct ft_trials trials;
+static uint64_t lap;
 
 
 #define FT_CLOSE_FID(fd) \
@@ -80,7 +83,7 @@ static int ft_init_rx_control(void)
 	ft_rx.cq_format = FI_CQ_FORMAT_MSG;
 	ft_rx.addr = FI_ADDR_UNSPEC;
 
-	ft_rx.msg_size = med_size_array[med_size_cnt - 1];
+	ft_rx.msg_size = ft.size_array[ft.size_cnt - 1];
 	if (fabric_info && fabric_info->ep_attr &&
 	    fabric_info->ep_attr->max_msg_size &&
 	    fabric_info->ep_attr->max_msg_size < ft_rx.msg_size)
@@ -103,6 +106,7 @@ static int ft_init_tx_control(void)
 
 static int ft_init_control(void)
 {
+	const char *spec;
 	int ret;
 
 	memset(&ft, 0, sizeof ft);
@@ -112,24 +116,34 @@ static int ft_init_control(void)
 	ft.iov_array = sm_size_array;
 	ft.iov_cnt = sm_size_cnt;
 
-	if (test_info.caps & FI_RMA) {
-		ft.size_array = lg_size_array;
-		ft.size_cnt = lg_size_cnt;
-	} else {
-		ft.size_array = med_size_array;
-		ft.size_cnt = med_size_cnt;
+	if (test_info.sizes[0])
+		spec = test_info.sizes;
+	else
+		spec = (test_info.caps & FI_RMA) ? FT_LG_SIZES : FT_MED_SIZES;
+
+	ret = ft_parse_sizes(spec, &ft.size_array, &ft.size_cnt);
+	if (ret) {
+		FT_PRINTERR("ft_parse_sizes", ret);
+		return ret;
 	}
 
 	ret = ft_init_rx_control();
 	if (!ret)
 		ret = ft_init_tx_control();
-	return ret;
+	if (ret)
+		return ret;
+
+	if (test_info.test_type == FT_TEST_BANDWIDTH && test_info.window) {
+		ft_tx.credits = ft_tx.max_credits = test_info.window;
+		ft_rx.credits = ft_rx.max_credits = test_info.window;
+	}
+	return 0;
 }
 
 static void ft_cleanup_xcontrol(struct ft_xcontrol *ctrl)
 {
 	FT_CLOSE_FID(ctrl->mr);
-	free(ctrl->buf);
+	ft_free_buf(ctrl->buf);
 	free(ctrl->iov);
 	free(ctrl->iov_desc);
 	memset(ctrl, 0, sizeof *ctrl);
@@ -165,12 +179,12 @@ static int ft_sync_test(int value)
 	if (ret)
 		return ret;
 
-	if (listen_sock < 0) {
-		ft_fw_send(sock, &value,  sizeof value);
-		ft_fw_recv(sock, &result, sizeof result);
+	if (!is_server) {
+		ft_sock_send(sock, &value,  sizeof value);
+		ft_sock_recv(sock, &result, sizeof result);
 	} else {
-		ft_fw_recv(sock, &result, sizeof result);
-		ft_fw_send(sock, &value,  sizeof value);
+		ft_sock_recv(sock, &result, sizeof result);
+		ft_sock_send(sock, &value,  sizeof value);
 	}
 
 	return result;
@@ -182,7 +196,7 @@ static int ft_pingpong(void)
 
 	// TODO: current flow will not handle manual progress mode
 	// it can get stuck with both sides receiving
-	if (listen_sock < 0) {
+	if (!is_server) {
 		for (i = 0; i < ft.xfer_iter; i++) {
 			ret = ft_send_msg();
 			if (ret)
@@ -191,6 +205,8 @@ static int ft_pingpong(void)
 			ret = ft_recv_msg();
 			if (ret)
 				return ret;
+
+			ft_hist_lap(&hist, &lap);
 		}
 	} else {
 		for (i = 0; i < ft.xfer_iter; i++) {
@@ -201,6 +217,8 @@ static int ft_pingpong(void)
 			ret = ft_send_msg();
 			if (ret)
 				return ret;
+
+			ft_hist_lap(&hist, &lap);
 		}
 	}
 
@@ -211,11 +229,13 @@ static int ft_pingpong_dgram(void)
 {
 	int ret, i;
 
-	if (listen_sock < 0) {
+	if (!is_server) {
 		for (i = 0; i < ft.xfer_iter; i++) {
 			ret = ft_sendrecv_dgram();
 			if (ret)
 				return ret;
+
+			ft_hist_lap(&hist, &lap);
 		}
 	} else {
 		for (i = 0; i < 1000; i++) {
@@ -230,6 +250,8 @@ static int ft_pingpong_dgram(void)
 			ret = ft_sendrecv_dgram();
 			if (ret)
 				return ret;
+
+			ft_hist_lap(&hist, &lap);
 		}
 
 		ret = ft_send_dgram();
@@ -240,30 +262,306 @@ static int ft_pingpong_dgram(void)
 	return 0;
 }
 
+/*
+ * Reads and writes complete only at the initiator, so the client times
+ * them alone and the server only drives progress.  Writes with remote CQ
+ * data notify the target and run the same flows as messages.
+ */
+static int ft_rma_passive(void)
+{
+	return ft_rma_func(test_info.class_function) &&
+	       test_info.class_function != FT_FUNC_WRITEDATA;
+}
+
+static int ft_rma_drain(void)
+{
+	int ret;
+
+	while (ft_tx.credits < ft_tx.max_credits) {
+		ret = ft_comp_tx();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Providers with manual data progress only service incoming reads and
+ * writes while the target reads its completions, so the server polls them
+ * until the client's next control message arrives.  The completion objects
+ * have no wait object to block on, so the socket is only checked once per
+ * run of FT_RMA_POLL_READS empty reads.
+ */
+#define FT_RMA_POLL_READS 1024
+
+static int ft_rma_progress(void)
+{
+	struct pollfd fds = { .fd = sock, .events = POLLIN };
+	size_t credits;
+	int ret, empty = 0;
+
+	for (;;) {
+		if (!empty) {
+			ret = poll(&fds, 1, 0);
+			if (ret > 0)
+				return 0;
+			if (ret < 0) {
+				perror("poll");
+				return -errno;
+			}
+			empty = FT_RMA_POLL_READS;
+		}
+
+		credits = ft_rx.credits;
+		ret = ft_comp_rx();
+		if (ret)
+			return ret;
+		if (ft_rx.credits == credits)
+			empty--;
+	}
+}
+
+static int ft_rma_latency(void)
+{
+	int ret, i;
+
+	if (is_server)
+		return ft_rma_progress();
+
+	for (i = 0; i < ft.xfer_iter; i++) {
+		ret = ft_send_msg();
+		if (ret)
+			return ret;
+
+		ret = ft_rma_drain();
+		if (ret)
+			return ret;
+
+		ft_hist_lap(&hist, &lap);
+	}
+
+	return 0;
+}
+
+static int ft_run_pingpong(int iters)
+{
+	ft.xfer_iter = iters;
+	lap = ft_timer_ticks();
+	if (ft_rma_passive())
+		return ft_rma_latency();
+
+	return (test_info.ep_type == FI_EP_DGRAM) ?
+		ft_pingpong_dgram() : ft_pingpong();
+}
+
+/* The client picks the size of every batch and sends it to the server. */
+static int ft_sync_iters(int *iters)
+{
+	if (!is_server)
+		return ft_sock_send(sock, iters, sizeof *iters);
+	else
+		return ft_sock_recv(sock, iters, sizeof *iters);
+}
+
+/*
+ * Results are named by the RMA operation, and with counter completions
+ * apart from CQ results.
+ */
+static void ft_perf_name(char *name, size_t len, const char *type)
+{
+	const char *op;
+
+	switch (test_info.class_function) {
+	case FT_FUNC_READ:
+	case FT_FUNC_READV:
+	case FT_FUNC_READMSG:
+		op = "_read";
+		break;
+	case FT_FUNC_WRITE:
+	case FT_FUNC_WRITEV:
+	case FT_FUNC_WRITEMSG:
+		op = "_write";
+		break;
+	case FT_FUNC_WRITEDATA:
+		op = "_writedata";
+		break;
+	default:
+		op = "";
+		break;
+	}
+
+	snprintf(name, len, "%s%s%s", type, op,
+		 test_info.comp_type == FT_COMP_COUNTER ? "_cntr" : "");
+}
+
 static int ft_run_latency(void)
+{
+	struct cs_opts lat_opts = opts;
+	char name[32];
+	int ret, i, xfers;
+
+	/* Datagram endpoints don't carry RMA */
+	if (test_info.ep_type == FI_EP_DGRAM &&
+	    ft_rma_func(test_info.class_function))
+		return -FI_ENOSYS;
+
+	xfers = ft_rma_passive() ? 1 : 2;
+	ft_perf_name(name, sizeof name, "lat");
+
+	if (test_info.iterations ||
+	    (test_info.test_flags & FT_FLAG_QUICKTEST))
+		lat_opts.user_options |= FT_OPT_ITER;
+
+	for (i = 0; i < ft.size_cnt; i += ft.inc_step) {
+		ft_tx.msg_size = ft.size_array[i];
+		if (ft_tx.msg_size > fabric_info->ep_attr->max_msg_size)
+			break;
+
+		if (test_info.iterations)
+			lat_opts.iterations = test_info.iterations;
+		else if (test_info.test_flags & FT_FLAG_QUICKTEST)
+			lat_opts.iterations = 5;
+		else
+			lat_opts.iterations = size_to_count(ft_tx.msg_size);
+
+		ret = ft_sync_test(0);
+		if (ret)
+			return ret;
+
+		ret = ft_run_trials(&lat_opts, ft_run_pingpong, ft_sync_iters,
+				    &hist, &trials);
+		if (ret)
+			return ret;
+
+		if (ft_rma_passive() && is_server)
+			continue;
+
+		ft_show_perf(&opts, fabric_info, name, ft_tx.msg_size, xfers,
+			&hist, &trials);
+		ft_record_size(ft_tx.msg_size, xfers, &trials);
+	}
+
+	return 0;
+}
+
+/*
+ * Receive iters messages, reposting buffers as they complete so that the
+ * sender's whole window can be matched.
+ */
+static int ft_bw_recv(int iters)
+{
+	size_t credits;
+	int ret;
+
+	while (iters > 0) {
+		if (ft_rx.credits) {
+			ret = ft_post_recv_bufs();
+			if (ret)
+				return ret;
+		}
+
+		credits = ft_rx.credits;
+		ret = ft_comp_rx();
+		if (ret)
+			return ret;
+		iters -= ft_rx.credits - credits;
+	}
+
+	return 0;
+}
+
+/*
+ * The client streams messages, keeping up to max_credits sends outstanding,
+ * and the server acknowledges the batch once it has received all of them.
+ */
+static int ft_bandwidth(void)
+{
+	int ret, i;
+
+	if (!is_server) {
+		for (i = 0; i < ft.xfer_iter; i++) {
+			ret = ft_send_msg();
+			if (ret)
+				return ret;
+		}
+
+		ret = ft_recv_msg();
+	} else {
+		ret = ft_bw_recv(ft.xfer_iter);
+		if (ret)
+			return ret;
+
+		ret = ft_send_msg();
+	}
+
+	return ret;
+}
+
+/* The client streams reads or writes and waits for all of them to complete */
+static int ft_rma_bandwidth(void)
 {
 	int ret, i;
 
+	if (is_server)
+		return ft_rma_progress();
+
+	for (i = 0; i < ft.xfer_iter; i++) {
+		ret = ft_send_msg();
+		if (ret)
+			return ret;
+	}
+
+	return ft_rma_drain();
+}
+
+static int ft_run_bw(int iters)
+{
+	ft.xfer_iter = iters;
+	return ft_rma_passive() ? ft_rma_bandwidth() : ft_bandwidth();
+}
+
+static int ft_run_bandwidth(void)
+{
+	struct cs_opts bw_opts = opts;
+	char name[32];
+	int ret, i;
+
+	/* Lost datagrams would leave the receiver waiting for the batch */
+	if (test_info.ep_type == FI_EP_DGRAM)
+		return -FI_ENOSYS;
+
+	ft_perf_name(name, sizeof name, "bw");
+	if (test_info.iterations ||
+	    (test_info.test_flags & FT_FLAG_QUICKTEST))
+		bw_opts.user_options |= FT_OPT_ITER;
+
 	for (i = 0; i < ft.size_cnt; i += ft.inc_step) {
 		ft_tx.msg_size = ft.size_array[i];
 		if (ft_tx.msg_size > fabric_info->ep_attr->max_msg_size)
 			break;
 
-		ft.xfer_iter = test_info.test_flags & FT_FLAG_QUICKTEST ?
-				5 : size_to_count(ft_tx.msg_size);
+		if (test_info.iterations)
+			bw_opts.iterations = test_info.iterations;
+		else if (test_info.test_flags & FT_FLAG_QUICKTEST)
+			bw_opts.iterations = ft_tx.max_credits;
+		else
+			bw_opts.iterations = size_to_count(ft_tx.msg_size);
 
 		ret = ft_sync_test(0);
 		if (ret)
 			return ret;
 
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		ret = (test_info.ep_type == FI_EP_DGRAM) ?
-			ft_pingpong_dgram() : ft_pingpong();
-		clock_gettime(CLOCK_MONOTONIC, &end);
+		ret = ft_run_trials(&bw_opts, ft_run_bw, ft_sync_iters,
+				    NULL, &trials);
 		if (ret)
 			return ret;
 
-		show_perf("lat", ft_tx.msg_size, ft.xfer_iter, &start, &end, 2);
+		if (ft_rma_passive() && is_server)
+			continue;
+
+		ft_show_perf(&opts, fabric_info, name, ft_tx.msg_size, 1,
+			NULL, &trials);
+		ft_record_size(ft_tx.msg_size, 1, &trials);
 	}
 
 	return 0;
@@ -275,12 +573,15 @@ static void ft_cleanup(void)
 	FT_CLOSE_FID(pep);
 	FT_CLOSE_FID(rxcq);
 	FT_CLOSE_FID(txcq);
+	FT_CLOSE_FID(rxcntr);
+	FT_CLOSE_FID(txcntr);
 	FT_CLOSE_FID(av);
 	FT_CLOSE_FID(eq);
-	FT_CLOSE_FID(domain);
-	FT_CLOSE_FID(fabric);
+	if (!reuse_domain)
+		ft_close_control();
 	ft_cleanup_xcontrol(&ft_rx);
 	ft_cleanup_xcontrol(&ft_tx);
+	free(ft.size_array);
 	memset(&ft, 0, sizeof ft);
 }
 
@@ -292,11 +593,12 @@ int ft_run_test()
 	if (ret)
 		return ret;
 
+	ft_reuse_control();
 	ret = ft_open_control();
 	if (ret)
 		return ret;
 
-	if (test_info.ep_type == FI_EP_MSG && listen_sock >= 0)
+	if (test_info.ep_type == FI_EP_MSG && is_server)
 		ret = ft_open_passive();
 	else
 		ret = ft_open_active();
@@ -311,6 +613,9 @@ int ft_run_test()
 	case FT_TEST_LATENCY:
 		ret = ft_run_latency();
 		break;
+	case FT_TEST_BANDWIDTH:
+		ret = ft_run_bandwidth();
+		break;
 	default:
 		ret = -FI_ENOSYS;
 		break;
@@ -41,6 +41,13 @@
 
 #include <time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FT_HAVE_TSC 1
+#else
+#define FT_HAVE_TSC 0
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,30 +59,58 @@ extern "C" {
 #include "osx/osd.h"
 #endif
 
-struct test_size_param {
-	int size;
-	int option;
-};
-
 enum precision {
 	NANO = 1,
 	MICRO = 1000,
 	MILLI = 1000000,
 };
 
+enum ft_output_fmt {
+	FT_OUT_HUMAN,
+	FT_OUT_YAML,
+	FT_OUT_JSON,
+	FT_OUT_CSV,
+};
+
+enum ft_timer_type {
+	FT_TIMER_CLOCK,
+	FT_TIMER_TSC,
+};
+
 /* client-server common options and option parsing */
 
+enum ft_buf_type {
+	FT_BUF_PAGE,
+	FT_BUF_MALLOC,
+	FT_BUF_THP,
+	FT_BUF_HUGETLB,
+};
+
 struct cs_opts {
 	int prhints;
 	int iterations;
+	int warmup_iterations;
+	int repeat;
+	double time_budget;
+	double converge;
 	int transfer_size;
 	char *src_port;
 	char *dst_port;
 	char *src_addr;
 	char *dst_addr;
-	int size_option;
+	char *oob_port;
+	int pairs;
+	size_t *sizes;
+	int size_cnt;
+	uint64_t *rates;
+	int rate_cnt;
+	char *cpus;
+	int mem_node;
+	enum ft_buf_type buf_type;
+	int verify;
 	int user_options;
-	int machr;
+	enum ft_output_fmt output;
+	enum ft_timer_type timer;
 	int argc;
 	char **argv;
 };
@@ -85,6 +120,52 @@ enum {
 	FT_OPT_SIZE = 1 << 1
 };
 
+/*
+ * TCP sockets used as an out-of-band control channel, independent of the
+ * fabric under test.  The calls return a socket or 0 on success and a
+ * negative error code on failure.
+ */
+int ft_sock_listen(char *service);
+int ft_sock_connect(char *node, char *service);
+int ft_sock_accept(int listen_fd);
+int ft_sock_send(int fd, void *msg, size_t len);
+int ft_sock_recv(int fd, void *msg, size_t len);
+void ft_sock_shutdown(int fd);
+
+/*
+ * Control channel between client and server of a simple test, opened by
+ * ft_oob_init when -O <port> is given.  While it is open, peer addresses
+ * are exchanged and ft_run_trials synchronizes every timed batch over TCP
+ * instead of the fabric, and the peer's results are collected with each
+ * measurement.
+ */
+#define FT_OOB_RETRIES		50
+#define FT_OOB_RETRY_USEC	100000
+
+extern int ft_oob_sock;
+
+int ft_oob_init(struct cs_opts *opts);
+void ft_oob_fini(void);
+int ft_oob_exchange(void *local, void *remote, size_t len);
+int ft_oob_barrier(void);
+int ft_oob_av_insert(struct fid_ep *ep, struct fid_av *av, fi_addr_t *addr,
+		     void *context);
+
+/*
+ * Multi-pair mode, selected with -M <pairs>.  ft_pairs_fork splits the
+ * test into that many processes, each running its own client or server
+ * on the base ports plus its pair index, and ft_pairs_join waits for them.
+ * Pairs on the same host start every transfer size together and pair 0
+ * reports the aggregate bandwidth and message rate of all pairs and how
+ * evenly the message rate was shared.
+ */
+#define FT_MAX_PAIRS	256
+
+extern int ft_pair_idx;
+
+int ft_pairs_fork(struct cs_opts *opts);
+int ft_pairs_join(int ret);
+
 void ft_parseinfo(int op, char *optarg, struct fi_info *hints);
 void ft_parse_addr_opts(int op, char *optarg, struct cs_opts *opts);
 void ft_parsecsopts(int op, char *optarg, struct cs_opts *opts);
@@ -92,19 +173,40 @@ void ft_usage(char *name, char *desc);
 void ft_csusage(char *name, char *desc);
 #define ADDR_OPTS "b:p:s:"
 #define INFO_OPTS "n:f:"
-#define CS_OPTS ADDR_OPTS "I:S:mi"
+#define CS_OPTS ADDR_OPTS "I:S:w:r:T:C:P:N:B:Q:W:O:M:R:t:F:mik"
 
 #define INIT_OPTS (struct cs_opts) { .iterations = 1000, \
+				     .repeat = 1, \
 				     .transfer_size = 1024, \
 				     .src_port = "9228", \
 				     .dst_port = "9228", \
+				     .mem_node = -1, \
+				     .timer = FT_TIMER_TSC, \
 				     .argc = argc, .argv = argv }
 
-extern struct test_size_param test_size[];
-const unsigned int test_cnt;
-#define TEST_CNT test_cnt
 #define FT_STR_LEN 32
 
+/*
+ * Message size sweeps, in the -S syntax.  FT_DEFAULT_SIZES is run when no
+ * -S option is given, FT_ALL_SIZES for -S all.
+ */
+#define FT_DEFAULT_SIZES	"64,96,192,4k,64k,1m"
+#define FT_ALL_SIZES		"2,8,32,64:8m:x2,96:6m:x2"
+#define FT_MAX_SIZE		(1 << 23)
+#define FT_MAX_SIZE_CNT		4096
+
+int ft_parse_sizes(const char *spec, size_t **sizes, int *cnt);
+int ft_size_cnt(struct cs_opts *opts);
+size_t ft_max_size(struct cs_opts *opts);
+
+#define FT_CPUS_LEN 256
+int ft_place_buf(struct cs_opts *opts, void *buf, size_t size);
+
+#define FT_HUGEPAGE_SIZE	(1 << 21)
+void *ft_alloc_buf(struct cs_opts *opts, size_t size);
+void ft_free_buf(void *buf);
+const char *ft_buf_str(enum ft_buf_type type);
+
 int ft_getsrcaddr(char *node, char *service, struct fi_info *hints);
 int ft_getdestaddr(char *node, char *service, struct fi_info *hints);
 char *size_str(char str[FT_STR_LEN], long long size);
@@ -116,16 +218,366 @@ int ft_finalize(struct fid_ep *tx_ep, struct fid_cq *scq, struct fid_cq *rcq,
 		fi_addr_t addr);
 
 
+/*
+ * Batched completion reaping.  Statistics accumulate over all CQs and are
+ * cleared with each new measurement.
+ */
+#define FT_CQ_BATCH	16
+#define FT_CQ_BATCH_MAX	64
+
+struct ft_cq_stats {
+	uint64_t reads;		/* fi_cq_read and fi_cq_sread calls */
+	uint64_t hits;		/* calls that returned completions */
+	uint64_t entries;	/* completions returned */
+	uint64_t empty;		/* calls that returned -FI_EAGAIN */
+	uint64_t sreads;	/* fi_cq_sread calls */
+};
+
+/*
+ * How ft_cq_get and ft_cq_wait wait for completions: polling fi_cq_read,
+ * blocking in fi_cq_sread, or polling for up to ft_cq_spin_usec before
+ * blocking.  The blocking modes require the CQ to be opened with the wait
+ * object returned by ft_cq_wait_obj.
+ */
+enum ft_cq_wait_mode {
+	FT_CQ_BUSY,
+	FT_CQ_BLOCK,
+	FT_CQ_SPIN_BLOCK
+};
+
+#define FT_CQ_SPIN_USEC	50
+
+extern int ft_cq_batch;
+extern enum ft_cq_wait_mode ft_cq_wait_mode;
+extern int ft_cq_spin_usec;
+extern struct ft_cq_stats ft_cq_stats;
+
+typedef void (*ft_cq_cb)(void *comp, void *arg);
+
+ssize_t ft_cq_reap(struct fid_cq *cq, size_t entry_size, int count,
+		   ft_cq_cb cb, void *arg);
+ssize_t ft_cq_get(struct fid_cq *cq, size_t entry_size, int count,
+		  ft_cq_cb cb, void *arg);
+int ft_cq_wait(struct fid_cq *cq, size_t entry_size, int count,
+	       ft_cq_cb cb, void *arg);
+enum fi_wait_obj ft_cq_wait_obj(void);
+const char *ft_cq_wait_str(void);
+void ft_cq_stats_reset(void);
+
+/*
+ * Bring-up timing.  Tests bracket each setup call with ft_setup_start and
+ * ft_setup_end; repeated calls of one kind accumulate.  The breakdown is
+ * reported along with the results.
+ */
+enum ft_setup_op {
+	FT_SETUP_GETINFO,
+	FT_SETUP_FABRIC,
+	FT_SETUP_DOMAIN,
+	FT_SETUP_ENDPOINT,
+	FT_SETUP_CQ,
+	FT_SETUP_CNTR,
+	FT_SETUP_MR,
+	FT_SETUP_AV,
+	FT_SETUP_ENABLE,
+	FT_SETUP_AV_INSERT,
+	FT_SETUP_CONNECT,
+	FT_SETUP_MAX
+};
+
+void ft_setup_start(enum ft_setup_op op);
+void ft_setup_end(enum ft_setup_op op);
+uint64_t ft_setup_nsec(enum ft_setup_op op, int *calls);
+const char *ft_setup_str(enum ft_setup_op op);
+void ft_setup_reset(void);
+
 int wait_for_data_completion(struct fid_cq *cq, int num_completions);
 int wait_for_completion(struct fid_cq *cq, int num_completions);
 void cq_readerr(struct fid_cq *cq, char *cq_str);
 
 int64_t get_elapsed(const struct timespec *b, const struct timespec *a, 
 		enum precision p);
-void show_perf(char *name, int tsize, int iters, struct timespec *start, 
-		struct timespec *end, int xfers_per_iter);
-void show_perf_mr(int tsize, int iters, struct timespec *start, 
-		struct timespec *end, int xfers_per_iter, int argc, char *argv[]);
+
+/*
+ * Timer used for per-iteration samples.  The TSC backend is only selected
+ * if the CPU advertises an invariant TSC, otherwise ft_timer_init falls
+ * back to clock_gettime.  Ticks are converted to nanoseconds with the
+ * calibrated ns_per_tick, and overhead holds the cost in nanoseconds of
+ * reading the timer, which is subtracted from every sample.
+ */
+struct ft_timer {
+	enum ft_timer_type type;
+	double ns_per_tick;
+	uint64_t overhead;
+};
+
+extern struct ft_timer ft_timer;
+
+int ft_timer_init(enum ft_timer_type type);
+const char *ft_timer_str(enum ft_timer_type type);
+
+static inline uint64_t ft_timer_ticks(void)
+{
+	struct timespec now;
+#if FT_HAVE_TSC
+	unsigned int aux;
+
+	if (ft_timer.type == FT_TIMER_TSC)
+		return __rdtscp(&aux);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static inline uint64_t ft_timer_ns(uint64_t ticks)
+{
+	return (uint64_t) (ticks * ft_timer.ns_per_tick);
+}
+
+/*
+ * Log-linear latency histogram.  Values are recorded in nanoseconds.
+ * Values below FT_HIST_SUB_CNT are counted exactly, larger values land in
+ * one of FT_HIST_SUB_CNT linear sub-buckets per power of two, which bounds
+ * the relative error of a reported percentile to 1 / FT_HIST_SUB_CNT.
+ */
+#define FT_HIST_SUB_BITS	5
+#define FT_HIST_SUB_CNT		(1 << FT_HIST_SUB_BITS)
+#define FT_HIST_BUCKETS		((64 - FT_HIST_SUB_BITS + 1) * FT_HIST_SUB_CNT)
+
+struct ft_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t bucket[FT_HIST_BUCKETS];
+};
+
+void ft_hist_reset(struct ft_hist *hist);
+uint64_t ft_hist_percentile(struct ft_hist *hist, double pct);
+
+static inline int ft_hist_index(uint64_t val)
+{
+	int shift;
+
+	if (val < FT_HIST_SUB_CNT)
+		return (int) val;
+
+	shift = 63 - __builtin_clzll(val) - FT_HIST_SUB_BITS;
+	return ((shift + 1) << FT_HIST_SUB_BITS) +
+		(int) ((val >> shift) & (FT_HIST_SUB_CNT - 1));
+}
+
+static inline void ft_hist_record(struct ft_hist *hist, uint64_t val)
+{
+	hist->bucket[ft_hist_index(val)]++;
+	hist->count++;
+	hist->sum += val;
+	if (val < hist->min)
+		hist->min = val;
+	if (val > hist->max)
+		hist->max = val;
+}
+
+/*
+ * Payload validation enabled with -k.  Each side fills a message with a
+ * pattern derived from its send sequence number and role (client or
+ * server) before sending it, and checks a received message against its
+ * receive sequence number and the peer's role.  A message that was never
+ * replaced by the peer's therefore fails the check.  The sequences stay in
+ * step as long as both sides fill and check every message of the timed
+ * loop.  The kernels are vectorized with AVX2 or SSE2 where available.
+ * Time spent in them is tracked in ticks and excluded from the reported
+ * latency and bandwidth.
+ */
+struct ft_verify {
+	uint64_t tx_seq;
+	uint64_t rx_seq;
+	uint64_t ticks;		/* total ticks spent filling and checking */
+	uint64_t lap;		/* ticks since the last ft_hist_lap */
+};
+
+extern struct ft_verify ft_verify;
+
+/* client is the role of the side that sent the message */
+void ft_fill_buf(void *buf, size_t size, uint64_t seq, int client);
+int ft_check_buf(void *buf, size_t size, uint64_t seq, int client);
+void ft_verify_fill_buf(void *buf, size_t size, int client);
+int ft_verify_check_buf(void *buf, size_t size, int client);
+
+static inline void ft_verify_fill(struct cs_opts *opts, void *buf, size_t size)
+{
+	if (opts->verify)
+		ft_verify_fill_buf(buf, size, opts->dst_addr != NULL);
+}
+
+static inline int ft_verify_check(struct cs_opts *opts, void *buf,
+				  size_t size)
+{
+	return opts->verify ?
+		ft_verify_check_buf(buf, size, opts->dst_addr == NULL) : 0;
+}
+
+/*
+ * Event trace enabled with -R <file>.  Every thread records timestamped
+ * events into its own ring of FT_TRACE_RING_SIZE entries, overwriting the
+ * oldest ones when it wraps, and the rings are written to the file at
+ * exit.  The file starts with a struct ft_trace_hdr, followed by a
+ * struct ft_trace_thread and its records, oldest first, for every thread.
+ * scripts/fttrace.py converts it to CSV or a latency-over-time series.
+ */
+#define FT_TRACE_MAGIC		"FTTRACE"
+#define FT_TRACE_VERSION	1
+#define FT_TRACE_RING_SIZE	(1 << 16)
+
+enum ft_trace_type {
+	FT_TRACE_POST,		/* arg: bytes */
+	FT_TRACE_COMP,		/* arg: completions read */
+	FT_TRACE_EAGAIN,	/* first empty CQ poll or busy post */
+	FT_TRACE_LAP,		/* arg: iteration latency in ns */
+};
+
+enum ft_trace_dir {
+	FT_TRACE_ANY,
+	FT_TRACE_TX,
+	FT_TRACE_RX,
+};
+
+struct ft_trace_rec {
+	uint64_t ticks;
+	uint32_t arg;
+	uint8_t type;
+	uint8_t dir;
+	uint16_t resv;
+};
+
+struct ft_trace_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t threads;
+	double ns_per_tick;
+};
+
+struct ft_trace_thread {
+	uint32_t tid;
+	uint32_t cnt;
+	uint64_t dropped;
+};
+
+extern int ft_trace_enabled;
+
+int ft_trace_init(const char *path);
+void ft_trace_rec(enum ft_trace_type type, enum ft_trace_dir dir,
+		  uint32_t arg);
+
+static inline void ft_trace(enum ft_trace_type type, enum ft_trace_dir dir,
+			    uint32_t arg)
+{
+	if (ft_trace_enabled)
+		ft_trace_rec(type, dir, arg);
+}
+
+/*
+ * Record the time since *last, less the timer overhead and any payload
+ * validation, and advance *last to the current tick count.
+ */
+static inline void ft_hist_lap(struct ft_hist *hist, uint64_t *last)
+{
+	uint64_t now, nsec;
+
+	now = ft_timer_ticks();
+	nsec = ft_timer_ns(now - *last - ft_verify.lap);
+	nsec = nsec > ft_timer.overhead ? nsec - ft_timer.overhead : 0;
+	ft_hist_record(hist, nsec);
+	ft_trace(FT_TRACE_LAP, FT_TRACE_ANY, nsec > UINT32_MAX ?
+		 UINT32_MAX : (uint32_t) nsec);
+	ft_verify.lap = 0;
+	*last = now;
+}
+
+/*
+ * Hardware event counts from perf_event_open, covering the calling thread
+ * and threads it creates after the counters are opened.  ft_perf_init
+ * opens them, and must be called before the fabric is opened for provider
+ * progress threads to be counted; ft_pairs_fork calls it in every pair.
+ * ft_perf_read returns -FI_ENOSYS if the counters are unavailable, e.g. in
+ * a VM without a virtual PMU.  Kernel events are excluded if
+ * perf_event_paranoid does not allow counting them.  Multiplexed counts
+ * are scaled to the time the counter was enabled.
+ */
+struct ft_perf_cnt {
+	uint64_t cycles;
+	uint64_t instrs;
+	uint64_t llc_misses;
+};
+
+void ft_perf_init(void);
+int ft_perf_read(struct ft_perf_cnt *cnt);
+
+/*
+ * Timed iterations of one transfer size, possibly spread over several
+ * trials.  elapsed is the total timed nanoseconds; mean and m2 track the
+ * per-trial usec/iteration for the mean, stddev and confidence interval.
+ * utime and stime are the user and system CPU usec the process, including
+ * any provider threads, consumed during the timed iterations run by
+ * ft_run_trials.  verify is the nanoseconds spent validating payloads,
+ * which are not part of elapsed.  perf is set if the hardware counters in
+ * hw were sampled as well.  offered is the target message rate of an
+ * open-loop run, 0 for closed-loop tests.
+ */
+struct ft_trials {
+	int cnt;
+	int iters;
+	int64_t elapsed;
+	double mean;
+	double m2;
+	int64_t utime;
+	int64_t stime;
+	int64_t verify;
+	double offered;
+	int perf;
+	struct ft_perf_cnt hw;
+};
+
+void ft_trials_reset(struct ft_trials *trials);
+void ft_trials_add(struct ft_trials *trials, struct timespec *start,
+		   struct timespec *end, int iters, struct ft_hist *hist);
+double ft_trials_stddev(struct ft_trials *trials);
+double ft_trials_ci95(struct ft_trials *trials);
+
+#define FT_BATCH_NSEC		(10 * 1000 * 1000)
+#define FT_CONVERGE_BATCHES	5
+#define FT_CONVERGE_MAX_SEC	10
+
+int ft_run_trials(struct cs_opts *opts, int (*run)(int iters),
+		  int (*sync)(int *iters), struct ft_hist *hist,
+		  struct ft_trials *trials);
+
+/*
+ * Open-loop load, selected with -L <rates> in tests that support it and
+ * parsed with ft_parse_rates.  For each offered rate, in
+ * messages per second, the client sends opts->iterations messages on a
+ * fixed schedule that does not wait for the server's echoes, with at most
+ * FT_LOAD_WINDOW of them outstanding.  The latency of an echo is measured
+ * from the scheduled send time of its request, so time spent behind
+ * schedule is counted rather than omitted.  send posts one message and
+ * returns -FI_EAGAIN if it cannot; poll returns the number of echoes
+ * received without blocking.
+ */
+#define FT_LOAD_WINDOW		64
+#define FT_MAX_RATE_CNT		256
+
+int ft_parse_rates(const char *spec, uint64_t **rates, int *cnt);
+int ft_run_load(struct cs_opts *opts, uint64_t rate, int (*send)(void),
+		int (*poll)(void), struct ft_hist *hist,
+		struct ft_trials *trials);
+
+/*
+ * Report the results of one transfer size in the format selected by
+ * opts->output.  info supplies the provider and endpoint type for the
+ * structured formats and may be NULL.
+ */
+void ft_show_perf(struct cs_opts *opts, struct fi_info *info, char *name,
+		  int tsize, int xfers_per_iter, struct ft_hist *hist,
+		  struct ft_trials *trials);
 
 #define FT_PRINTERR(call, retv) \
 	do { fprintf(stderr, call "(): %d, %d (%s)\n", __LINE__, (int) retv, fi_strerror((int) -retv)); } while (0)
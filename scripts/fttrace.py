@@ -0,0 +1,97 @@
+#!/usr/bin/env python
+
+# Decodes the event trace written by the fabtests -R option.
+#
+# By default every event is printed as CSV, ordered by time, with the time
+# in microseconds since the first event.  With -l the iteration latencies
+# are summarized per interval instead, giving a latency-over-time series.
+
+import sys
+import struct
+from optparse import OptionParser
+
+HDR = struct.Struct("=8sIId")
+THREAD = struct.Struct("=IIQ")
+REC = struct.Struct("=QIBBH")
+
+TYPES = ["post", "comp", "eagain", "lap"]
+DIRS = ["-", "tx", "rx"]
+LAP = TYPES.index("lap")
+
+def read_trace(name):
+	with open(name, "rb") as f:
+		data = f.read()
+
+	magic, version, threads, ns_per_tick = HDR.unpack_from(data, 0)
+	if magic.rstrip(b"\0") != b"FTTRACE" or version != 1:
+		raise ValueError("%s: not a fabtests trace" % name)
+
+	events = []
+	off = HDR.size
+	for t in range(threads):
+		tid, cnt, dropped = THREAD.unpack_from(data, off)
+		off += THREAD.size
+		if dropped:
+			sys.stderr.write("thread %d: %d oldest events dropped\n" %
+					 (tid, dropped))
+		for i in range(cnt):
+			ticks, arg, type, dir, resv = REC.unpack_from(data, off)
+			off += REC.size
+			events.append((ticks, tid, type, dir, arg))
+
+	events.sort()
+	return ns_per_tick, events
+
+def show_csv(ns_per_tick, events):
+	print("tid,time_usec,event,dir,arg")
+	if not events:
+		return
+	start = events[0][0]
+	for ticks, tid, type, dir, arg in events:
+		print("%d,%.3f,%s,%s,%d" % (tid, (ticks - start) * ns_per_tick / 1000,
+			TYPES[type] if type < len(TYPES) else type,
+			DIRS[dir] if dir < len(DIRS) else dir, arg))
+
+def show_latency(ns_per_tick, events, interval):
+	print("time_usec,iters,lat_min,lat_mean,lat_max")
+	laps = [(e[0], e[4]) for e in events if e[2] == LAP]
+	if not laps:
+		return
+	start = laps[0][0]
+	bin = None
+	for ticks, nsec in laps:
+		t = int((ticks - start) * ns_per_tick / 1000 / interval)
+		if bin is not None and t != bin:
+			print("%d,%d,%.3f,%.3f,%.3f" % (bin * interval, cnt,
+				lo / 1000.0, total / 1000.0 / cnt, hi / 1000.0))
+			bin = None
+		if bin is None:
+			bin, cnt, total, lo, hi = t, 0, 0, nsec, nsec
+		cnt += 1
+		total += nsec
+		lo = min(lo, nsec)
+		hi = max(hi, nsec)
+	print("%d,%d,%.3f,%.3f,%.3f" % (bin * interval, cnt,
+		lo / 1000.0, total / 1000.0 / cnt, hi / 1000.0))
+
+def main(argv=None):
+	parser = OptionParser(usage="usage: %prog [options] trace_file")
+	parser.add_option("-l", "--latency", action="store_true",
+			  help="print iteration latency over time")
+	parser.add_option("-i", "--interval", type="int", default=1000,
+			  help="latency interval in usec (default 1000)")
+	(options, args) = parser.parse_args(argv)
+
+	if len(args) != 1 or options.interval <= 0:
+		parser.print_help()
+		return 1
+
+	ns_per_tick, events = read_trace(args[0])
+	if options.latency:
+		show_latency(ns_per_tick, events, options.interval)
+	else:
+		show_csv(ns_per_tick, events)
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -89,7 +89,7 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_cq_attr cq_attr;
 	int ret;
 
-	buffer_size = test_size[TEST_CNT - 1].size;
+	buffer_size = FT_MAX_SIZE;
 	buf = malloc(buffer_size);
 	if (!buf) {
 		perror("malloc");
@@ -45,11 +45,12 @@ static struct cs_opts opts;
 static int max_credits = 128;
 static int credits = 128;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
+static struct ft_hist hist;
 static void *buf;
 static size_t buffer_size;
 
-static struct fi_info *hints;
+static struct fi_info *hints, *fi;
 
 static struct fid_fabric *fab;
 static struct fid_pep *pep;
@@ -65,10 +66,8 @@ static int send_xfer(int size)
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			goto post;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
+		ret = ft_cq_get(scq, sizeof comp, max_credits, NULL, NULL);
+		if (ret < 0) {
 			if (ret == -FI_EAVAIL) {
 				cq_readerr(scq, "scq");
 			} else {
@@ -76,10 +75,11 @@ static int send_xfer(int size)
 			}
 			return ret;
 		}
+		credits += ret;
 	}
 
 	credits--;
-post:
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), 0, NULL);
 	if (ret)
 		FT_PRINTERR("fi_send", ret);
@@ -92,19 +92,12 @@ static int recv_xfer(int size)
 	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(rcq, "rcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), 0, buf);
 	if (ret)
 		FT_PRINTERR("fi_recv", ret);
@@ -122,6 +115,9 @@ static int sync_test(void)
 	}
 	credits = max_credits;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret) {
 		return ret;
@@ -130,32 +126,81 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
-static int run_test()
+/* Client tells the server how many iterations the next batch runs. */
+static int sync_iters(int *iters)
 {
-	int ret, i;
+	int ret;
 
-	ret = sync_test();
+	if (opts.dst_addr) {
+		*(int *) buf = *iters;
+		ret = send_xfer(sizeof *iters);
+		if (ret)
+			return ret;
+
+		return recv_xfer(sizeof *iters);
+	}
+
+	ret = recv_xfer(sizeof *iters);
 	if (ret)
 		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
-		ret = opts.dst_addr ? send_xfer(opts.transfer_size) :
-				 recv_xfer(opts.transfer_size);
-		if (ret)
-			return ret;
+	*iters = *(int *) buf;
+	return send_xfer(sizeof *iters);
+}
+
+static int pingpong(int iters)
+{
+	uint64_t lap;
+	int ret, i;
 
-		ret = opts.dst_addr ? recv_xfer(opts.transfer_size) :
-				 send_xfer(opts.transfer_size);
+	lap = ft_timer_ticks();
+	for (i = 0; i < iters; i++) {
+		if (opts.dst_addr) {
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+		} else {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+		}
 		if (ret)
 			return ret;
+
+		ft_hist_lap(&hist, &lap);
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, &start, &end, 2);
+	return 0;
+}
+
+static int run_test()
+{
+	int ret;
+
+	ret = sync_test();
+	if (ret)
+		return ret;
+
+	ret = ft_run_trials(&opts, pingpong, sync_iters, &hist, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 2, &hist,
+			&trials);
 
 	return 0;
 }
@@ -184,7 +229,7 @@ static void free_ep_res(void)
 	fi_close(&mr->fid);
 	fi_close(&rcq->fid);
 	fi_close(&scq->fid);
-	free(buf);
+	ft_free_buf(buf);
 }
 
 static int alloc_ep_res(void)
@@ -192,9 +237,8 @@ static int alloc_ep_res(void)
 	struct fi_cq_attr cq_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	buf = malloc(buffer_size);
+	buffer_size = ft_max_size(&opts);
+	buf = ft_alloc_buf(&opts, buffer_size);
 	if (!buf) {
 		perror("malloc");
 		return -1;
@@ -202,21 +246,27 @@ static int alloc_ep_res(void)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -237,7 +287,7 @@ err3:
 err2:
 	fi_close(&scq->fid);
 err1:
-	free(buf);
+	ft_free_buf(buf);
 	return ret;
 }
 
@@ -263,7 +313,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -279,23 +331,27 @@ static int bind_ep_res(void)
 
 static int server_listen(void)
 {
-	struct fi_info *fi;
+	struct fi_info *info;
 	int ret;
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, opts.src_addr, opts.src_port, FI_SOURCE,
-			hints, &fi);
+			hints, &info);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
 	}
 
-	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_start(FT_SETUP_FABRIC);
+	ret = fi_fabric(info->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
-	ret = fi_passive_ep(fab, fi, &pep, NULL);
+	ret = fi_passive_ep(fab, info, &pep, NULL);
 	if (ret) {
 		FT_PRINTERR("fi_passive_ep", ret);
 		goto err1;
@@ -317,7 +373,7 @@ static int server_listen(void)
 		goto err3;
 	}
 
-	fi_freeinfo(fi);
+	fi_freeinfo(info);
 	return 0;
 err3:
 	free_lres();
@@ -326,7 +382,7 @@ err2:
 err1:
 	fi_close(&fab->fid);
 err0:
-	fi_freeinfo(fi);
+	fi_freeinfo(info);
 	return ret;
 }
 
@@ -351,13 +407,17 @@ static int server_connect(void)
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, info, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, info, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err1;
@@ -371,6 +431,7 @@ static int server_connect(void)
 	if (ret)
 		goto err3;
 
+	ft_setup_start(FT_SETUP_CONNECT);
 	ret = fi_accept(ep, NULL, 0);
 	if (ret) {
 		FT_PRINTERR("fi_accept", ret);
@@ -378,6 +439,7 @@ static int server_connect(void)
 	}
 
 	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	ft_setup_end(FT_SETUP_CONNECT);
 	if (rd != sizeof entry) {
 		FT_PRINTERR("fi_eq_sread", rd);
 		goto err3;
@@ -392,7 +454,7 @@ static int server_connect(void)
 
 	fi_close(&pep->fid);
 
-	fi_freeinfo(info);
+	fi = info;
 	return 0;
 
 err3:
@@ -410,7 +472,6 @@ static int client_connect(void)
 	struct fi_eq_cm_entry entry;
 	struct fi_eq_err_entry err;
 	uint32_t event;
-	struct fi_info *fi;
 	ssize_t rd;
 	int ret;
 
@@ -418,25 +479,33 @@ static int client_connect(void)
 	if (ret)
 		return ret;
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, opts.dst_addr, opts.dst_port, 0, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err3;
@@ -450,6 +519,7 @@ static int client_connect(void)
 	if (ret)
 		goto err5;
 
+	ft_setup_start(FT_SETUP_CONNECT);
 	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
 	if (ret) {
 		FT_PRINTERR("fi_connect", ret);
@@ -457,6 +527,7 @@ static int client_connect(void)
 	}
 
 	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	ft_setup_end(FT_SETUP_CONNECT);
 	if (rd != sizeof entry) {
 		if (rd == -FI_EAVAIL) {
 			rd = fi_eq_readerr(cmeq, &err, 0);
@@ -479,7 +550,6 @@ static int client_connect(void)
 		goto err5;
 	}
 
-	fi_freeinfo(fi);
 	return 0;
 
 err5:
@@ -492,6 +562,7 @@ err2:
 	fi_close(&fab->fid);
 err1:
 	fi_freeinfo(fi);
+	fi = NULL;
 err0:
 	return ret;
 }
@@ -500,6 +571,10 @@ static int run(void)
 {
 	int i, ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	if (!opts.dst_addr) {
 		ret = server_listen();
 		if (ret)
@@ -511,17 +586,8 @@ static int run(void)
 		return ret;
 	}
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -539,6 +605,7 @@ out:
 		free_lres();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -576,8 +643,12 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
+	fi_freeinfo(fi);
 	return ret;
 }
@@ -47,13 +47,13 @@ static struct cs_opts opts;
 static int max_credits = 128;
 static int credits = 128;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
 static void *buf;
 static size_t buffer_size;
 struct fi_rma_iov local, remote;
 static uint64_t cq_data = 1;
 
-static struct fi_info *hints;
+static struct fi_info *hints, *fi;
 
 static struct fid_fabric *fab;
 static struct fid_pep *pep;
@@ -69,10 +69,8 @@ static int send_xfer(int size)
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			goto post;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
+		ret = ft_cq_get(scq, sizeof comp, max_credits, NULL, NULL);
+		if (ret < 0) {
 			if (ret == -FI_EAVAIL) {
 				cq_readerr(scq, "scq");
 			} else {
@@ -80,10 +78,11 @@ static int send_xfer(int size)
 			}
 			return ret;
 		}
+		credits += ret;
 	}
 
 	credits--;
-post:
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), 0, ep);
 	if (ret)
 		FT_PRINTERR("fi_send", ret);
@@ -96,18 +95,11 @@ static int recv_xfer(int size)
 	struct fi_cq_data_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(rcq, "rcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), 0, buf);
 	if (ret)
 		FT_PRINTERR("fi_recv", ret);
@@ -165,6 +157,9 @@ static int sync_test(void)
 	}
 	credits = max_credits;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret) {
 		return ret;
@@ -173,22 +168,19 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
+static void save_comp(void *comp, void *arg)
+{
+	memcpy(arg, comp, sizeof(struct fi_cq_data_entry));
+}
+
 static int wait_remote_writedata_completion(void)
 {
 	struct fi_cq_data_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(rcq, "rcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, save_comp, &comp);
+	if (ret)
+		return ret;
 
 	ret = 0;
 	if (comp.data != cq_data) {
@@ -206,16 +198,11 @@ static int wait_remote_writedata_completion(void)
 	return ret;
 }
 
-static int run_test(void)
+static int rma(int iters)
 {
 	int ret, i;
 
-	ret = sync_test();
-	if (ret)
-		return ret;
-
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
+	for (i = 0; i < iters; i++) {
 		switch (op_type) {
 		case FT_RMA_WRITE:
 			ret = write_data(opts.transfer_size);
@@ -236,14 +223,23 @@ static int run_test(void)
 		if (ret)
 			return ret;
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 
-				1, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, 
-				&start, &end, 1);
+	return 0;
+}
+
+static int run_test(void)
+{
+	int ret;
+
+	ret = sync_test();
+	if (ret)
+		return ret;
+
+	ret = ft_run_trials(&opts, rma, NULL, NULL, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 1, NULL, &trials);
 
 	return 0;
 }
@@ -272,7 +268,7 @@ static void free_ep_res(void)
 	fi_close(&mr->fid);
 	fi_close(&rcq->fid);
 	fi_close(&scq->fid);
-	free(buf);
+	ft_free_buf(buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -281,9 +277,8 @@ static int alloc_ep_res(struct fi_info *fi)
 	uint64_t access_mode;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	buf = malloc(MAX(buffer_size, sizeof(uint64_t)));
+	buffer_size = ft_max_size(&opts);
+	buf = ft_alloc_buf(&opts, MAX(buffer_size, sizeof(uint64_t)));
 	if (!buf) {
 		perror("malloc");
 		return -1;
@@ -291,15 +286,19 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_DATA;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
@@ -318,8 +317,10 @@ static int alloc_ep_res(struct fi_info *fi)
 		ret = -FI_EINVAL;
 		goto err3;
 	}
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, MAX(buffer_size, sizeof(uint64_t)), 
 			access_mode, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -340,7 +341,7 @@ err3:
 err2:
 	fi_close(&scq->fid);
 err1:
-	free(buf);
+	ft_free_buf(buf);
 	return ret;
 }
 
@@ -366,7 +367,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -382,23 +385,27 @@ static int bind_ep_res(void)
 
 static int server_listen(void)
 {
-	struct fi_info *fi;
+	struct fi_info *info;
 	int ret;
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, opts.src_addr, opts.src_port, FI_SOURCE,
-			hints, &fi);
+			hints, &info);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
 	}
 
-	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_start(FT_SETUP_FABRIC);
+	ret = fi_fabric(info->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
-	ret = fi_passive_ep(fab, fi, &pep, NULL);
+	ret = fi_passive_ep(fab, info, &pep, NULL);
 	if (ret) {
 		FT_PRINTERR("fi_passive_ep", ret);
 		goto err1;
@@ -420,7 +427,7 @@ static int server_listen(void)
 		goto err3;
 	}
 
-	fi_freeinfo(fi);
+	fi_freeinfo(info);
 	return 0;
 err3:
 	free_lres();
@@ -429,7 +436,7 @@ err2:
 err1:
 	fi_close(&fab->fid);
 err0:
-	fi_freeinfo(fi);
+	fi_freeinfo(info);
 	return ret;
 }
 
@@ -454,14 +461,18 @@ static int server_connect(void)
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, info, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, info, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", -ret);
 		goto err1;
@@ -475,6 +486,7 @@ static int server_connect(void)
 	if (ret)
 		goto err3;
 
+	ft_setup_start(FT_SETUP_CONNECT);
 	ret = fi_accept(ep, NULL, 0);
 	if (ret) {
 		FT_PRINTERR("fi_accept", ret);
@@ -482,6 +494,7 @@ static int server_connect(void)
 	}
 
 	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	ft_setup_end(FT_SETUP_CONNECT);
  	if (rd != sizeof entry) {
 		FT_PRINTERR("fi_eq_sread", rd);
 		goto err3;
@@ -494,7 +507,7 @@ static int server_connect(void)
  		goto err3;
  	}
  
- 	fi_freeinfo(info);
+ 	fi = info;
  	return 0;
 
 err3:
@@ -512,7 +525,6 @@ static int client_connect(void)
 {
 	struct fi_eq_cm_entry entry;
 	uint32_t event;
-	struct fi_info *fi;
 	ssize_t rd;
 	int ret;
 
@@ -520,25 +532,33 @@ static int client_connect(void)
 	if (ret)
 		return ret;
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, opts.dst_addr, opts.dst_port, 0, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
  	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err3;
@@ -552,6 +572,7 @@ static int client_connect(void)
 	if (ret)
 		goto err5;
 
+	ft_setup_start(FT_SETUP_CONNECT);
 	ret = fi_connect(ep, fi->dest_addr, NULL, 0);
 	if (ret) {
 		FT_PRINTERR("fi_connect", ret);
@@ -559,6 +580,7 @@ static int client_connect(void)
 	}
 
  	rd = fi_eq_sread(cmeq, &event, &entry, sizeof entry, -1, 0);
+	ft_setup_end(FT_SETUP_CONNECT);
 	if (rd != sizeof entry) {
 		FT_PRINTERR("fi_eq_sread", rd);
 		return (int) rd;
@@ -571,7 +593,6 @@ static int client_connect(void)
  		goto err1;
  	}
 
-	fi_freeinfo(fi);
 	return 0;
 
 err5:
@@ -584,6 +605,7 @@ err2:
 	fi_close(&fab->fid);
 err1:
 	fi_freeinfo(fi);
+	fi = NULL;
 err0:
 	return ret;
 }
@@ -593,6 +615,9 @@ static int exchange_addr_key(void)
 	local.addr = (uintptr_t) buf;
 	local.key = fi_mr_key(mr);
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_exchange(&local, &remote, sizeof local);
+
 	if (opts.dst_addr) {
 		*(struct fi_rma_iov *)buf = local;
 		send_xfer(sizeof local);
@@ -612,6 +637,10 @@ static int run(void)
 {
 	int i, ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	if (!opts.dst_addr) {
 		ret = server_listen();
 		if (ret)
@@ -626,17 +655,8 @@ static int run(void)
 	if (ret)
 		return ret;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -655,6 +675,7 @@ out:
 		free_lres();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -709,8 +730,12 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
+	fi_freeinfo(fi);
 	return ret;
 }
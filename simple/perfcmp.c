@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2013-2014 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AWV
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares two result files written by the performance tests with -F yaml,
+ * json or csv.  Results are matched by test, name, provider, endpoint type
+ * and transfer size, and each selected metric of the new file is checked
+ * against the base file.  The exit status is 0 if nothing regressed, 1 if
+ * a metric regressed or a base result is missing from the new file, and 2
+ * on errors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <getopt.h>
+
+#define PC_MAX_FIELDS	128
+#define PC_MAX_METRICS	16
+#define PC_KEY_LEN	256
+
+struct pc_field {
+	char *name;
+	char *val;
+};
+
+struct pc_rec {
+	char key[PC_KEY_LEN];
+	int cnt;
+	struct pc_field field[PC_MAX_FIELDS];
+	int matched;
+};
+
+struct pc_file {
+	const char *name;
+	int cnt;
+	struct pc_rec *rec;
+};
+
+static const char *metrics[PC_MAX_METRICS];
+static int metric_cnt;
+static double max_pct = 5.0;
+static double max_sd;
+static int quiet;
+
+/* Metrics where a larger value is better; all others are costs. */
+static const char *pc_higher[] = {
+	"gbps", "msg_rate", "aggregate_gbps", "aggregate_msg_rate", "fairness",
+};
+
+/*
+ * The yaml format names per-transfer values "x/xfer" and bandwidth
+ * "Gb/sec", where json and csv use "x_per_xfer" and "gbps".
+ */
+static char *pc_norm_name(const char *name)
+{
+	char str[PC_KEY_LEN], *s;
+
+	if (!strcmp(name, "Gb/sec"))
+		return strdup("gbps");
+
+	for (s = str; *name && s < str + sizeof str - 6; name++) {
+		if (*name == '/') {
+			strcpy(s, "_per_");
+			s += 5;
+		} else {
+			*s++ = *name;
+		}
+	}
+	*s = '\0';
+	return strdup(str);
+}
+
+static const char *pc_get(struct pc_rec *rec, const char *name)
+{
+	int i;
+
+	for (i = 0; i < rec->cnt; i++) {
+		if (!strcmp(rec->field[i].name, name))
+			return rec->field[i].val;
+	}
+	return NULL;
+}
+
+static int pc_add(struct pc_rec *rec, const char *name, const char *val)
+{
+	if (rec->cnt == PC_MAX_FIELDS)
+		return 0;
+
+	rec->field[rec->cnt].name = pc_norm_name(name);
+	rec->field[rec->cnt].val = strdup(val);
+	if (!rec->field[rec->cnt].name || !rec->field[rec->cnt].val)
+		return -1;
+	rec->cnt++;
+	return 0;
+}
+
+static void pc_set_key(struct pc_rec *rec)
+{
+	static const char *keys[] = {
+		"test", "name", "provider", "ep_type", "xfer_size",
+	};
+	const char *val;
+	size_t len = 0;
+	int i;
+
+	rec->key[0] = '\0';
+	for (i = 0; i < sizeof keys / sizeof keys[0]; i++) {
+		val = pc_get(rec, keys[i]);
+		if (!val || !*val)
+			continue;
+		len += snprintf(rec->key + len, sizeof rec->key - len, "%s%s",
+				len ? " " : "", val);
+		if (len >= sizeof rec->key)
+			break;
+	}
+}
+
+static char *pc_trim(char *str)
+{
+	char *end;
+
+	while (isspace(*str))
+		str++;
+	end = str + strlen(str);
+	while (end > str && isspace(end[-1]))
+		*--end = '\0';
+	return str;
+}
+
+/* Reads a quoted string at *str in place, undoing \ or "" escapes. */
+static char *pc_quoted(char **str, int csv)
+{
+	char *src = *str + 1, *dst = src, *val = src;
+
+	while (*src) {
+		if (csv && src[0] == '"' && src[1] == '"') {
+			*dst++ = '"';
+			src += 2;
+		} else if (!csv && src[0] == '\\' && src[1]) {
+			*dst++ = src[1];
+			src += 2;
+		} else if (*src == '"') {
+			src++;
+			break;
+		} else {
+			*dst++ = *src++;
+		}
+	}
+	*dst = '\0';
+	*str = src;
+	return val;
+}
+
+static int pc_split_csv(char *line, char **val, int max)
+{
+	char *end;
+	int cnt = 0;
+
+	while (cnt < max) {
+		if (*line == '"') {
+			val[cnt++] = pc_quoted(&line, 1);
+			line = strchr(line, ',');
+		} else {
+			val[cnt++] = line;
+			end = strchr(line, ',');
+			if (end)
+				*end = '\0';
+			line = end;
+		}
+		if (!line)
+			break;
+		*line++ = '\0';
+	}
+	return cnt;
+}
+
+/*
+ * Parses one json object or yaml flow mapping.  Nested objects and lists
+ * are skipped.
+ */
+static int pc_parse_map(char *str, struct pc_rec *rec)
+{
+	char *key, *val, *end;
+	int depth;
+
+	str = strchr(str, '{') + 1;
+	for (;;) {
+		while (isspace(*str) || *str == ',')
+			str++;
+		if (!*str || *str == '}')
+			return 0;
+
+		if (*str == '"') {
+			key = pc_quoted(&str, 0);
+			str = strchr(str, ':');
+			if (!str)
+				return -1;
+		} else {
+			key = str;
+			str = strchr(str, ':');
+			if (!str)
+				return -1;
+			*str = '\0';
+			key = pc_trim(key);
+		}
+		str++;
+		while (isspace(*str))
+			str++;
+
+		if (*str == '"') {
+			val = pc_quoted(&str, 0);
+		} else if (*str == '{' || *str == '[') {
+			for (depth = 0; *str; str++) {
+				if (*str == '{' || *str == '[')
+					depth++;
+				else if ((*str == '}' || *str == ']') && !--depth)
+					break;
+			}
+			if (*str)
+				str++;
+			continue;
+		} else {
+			val = str;
+			end = str + strcspn(str, ",}");
+			str = *end ? end + 1 : end;
+			if (*end == '}')
+				str = end;
+			*end = '\0';
+			val = pc_trim(val);
+		}
+
+		if (pc_add(rec, key, val))
+			return -1;
+	}
+}
+
+static struct pc_rec *pc_new_rec(struct pc_file *file)
+{
+	struct pc_rec *rec;
+
+	rec = realloc(file->rec, (file->cnt + 1) * sizeof *rec);
+	if (!rec)
+		return NULL;
+
+	file->rec = rec;
+	rec = &file->rec[file->cnt];
+	memset(rec, 0, sizeof *rec);
+	return rec;
+}
+
+static int pc_load(struct pc_file *file)
+{
+	char *line = NULL, *str, *hdr[PC_MAX_FIELDS], *val[PC_MAX_FIELDS];
+	char *csv = NULL, *test = NULL;
+	struct pc_rec *rec;
+	size_t size = 0;
+	int i, hdr_cnt = 0, cnt, ret = 0;
+	FILE *f;
+
+	f = fopen(file->name, "r");
+	if (!f) {
+		perror(file->name);
+		return -1;
+	}
+
+	while (getline(&line, &size, f) > 0) {
+		str = pc_trim(line);
+		if (!strncmp(str, "--- #", 5)) {
+			free(test);
+			test = strdup(pc_trim(str + 5));
+			continue;
+		}
+
+		if (!strncmp(str, "- {", 3) || *str == '{') {
+			rec = pc_new_rec(file);
+			if (!rec || pc_parse_map(str, rec) ||
+			    (test && !pc_get(rec, "test") &&
+			     pc_add(rec, "test", test))) {
+				ret = -1;
+				break;
+			}
+		} else if (!csv && strstr(str, "xfer_size,")) {
+			csv = strdup(str);
+			if (!csv) {
+				ret = -1;
+				break;
+			}
+			hdr_cnt = pc_split_csv(csv, hdr, PC_MAX_FIELDS);
+			continue;
+		} else if (csv && *str) {
+			rec = pc_new_rec(file);
+			if (!rec) {
+				ret = -1;
+				break;
+			}
+			cnt = pc_split_csv(str, val, PC_MAX_FIELDS);
+			for (i = 0; i < cnt && i < hdr_cnt && !ret; i++)
+				ret = pc_add(rec, hdr[i], val[i]);
+			if (ret)
+				break;
+		} else {
+			continue;
+		}
+
+		pc_set_key(rec);
+		file->cnt++;
+	}
+
+	if (ret)
+		fprintf(stderr, "%s: unable to parse results\n", file->name);
+	free(line);
+	free(csv);
+	free(test);
+	fclose(f);
+	return ret;
+}
+
+static struct pc_rec *pc_find(struct pc_file *file, const char *key)
+{
+	int i;
+
+	for (i = 0; i < file->cnt; i++) {
+		if (!strcmp(file->rec[i].key, key))
+			return &file->rec[i];
+	}
+	return NULL;
+}
+
+static int pc_num(struct pc_rec *rec, const char *name, double *val)
+{
+	const char *str = pc_get(rec, name);
+	char *end;
+
+	if (!str || !*str)
+		return -1;
+
+	*val = strtod(str, &end);
+	return end == str ? -1 : 0;
+}
+
+/*
+ * The run to run standard deviation is only reported for usec_per_xfer.
+ * Its relative value applies to the rates derived from it as well.
+ */
+static double pc_stddev(struct pc_rec *rec, double val)
+{
+	double lat, sd;
+
+	if (!pc_num(rec, "usec_per_xfer", &lat) && lat > 0 &&
+	    !pc_num(rec, "usec_per_xfer_stddev", &sd))
+		return fabs(val) * sd / lat;
+	return 0;
+}
+
+static int pc_higher_better(const char *metric)
+{
+	int i;
+
+	for (i = 0; i < sizeof pc_higher / sizeof pc_higher[0]; i++) {
+		if (!strcmp(metric, pc_higher[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static int pc_compare(struct pc_rec *base, struct pc_rec *new)
+{
+	double b, n, worse, pct, noise;
+	const char *status;
+	int i, bad, regressed = 0;
+
+	for (i = 0; i < metric_cnt; i++) {
+		if (pc_num(base, metrics[i], &b) || pc_num(new, metrics[i], &n))
+			continue;
+
+		worse = pc_higher_better(metrics[i]) ? b - n : n - b;
+		pct = b ? worse * 100.0 / fabs(b) : 0;
+		noise = max_sd * sqrt(pow(pc_stddev(base, b), 2) +
+				      pow(pc_stddev(new, n), 2));
+
+		bad = pct > max_pct && worse > noise;
+		if (bad) {
+			status = "REGRESSED";
+			regressed = 1;
+		} else if (pct > max_pct) {
+			status = "noise";
+		} else if (pct < -max_pct) {
+			status = "improved";
+		} else {
+			status = "ok";
+		}
+
+		if (!quiet || bad)
+			printf("%-48s %-20s %14.3f %14.3f %+8.1f%% %s\n",
+				base->key, metrics[i], b, n,
+				b ? (n - b) * 100.0 / fabs(b) : 0, status);
+	}
+	return regressed;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [OPTIONS] <base_results> <new_results>\n",
+		name);
+	fprintf(stderr, "\nCompares results written with -F yaml, json or csv.\n");
+	fprintf(stderr, "\nOptions:\n");
+	fprintf(stderr, "  -m <metric>\tmetric to compare, may be repeated\n"
+			"\t\t(default usec_per_xfer and gbps)\n");
+	fprintf(stderr, "  -p <percent>\tregression threshold in percent (default 5)\n");
+	fprintf(stderr, "  -s <count>\talso require the change to exceed count combined\n"
+			"\t\tstandard deviations, when the results include them\n");
+	fprintf(stderr, "  -q\t\tonly print regressions\n");
+	fprintf(stderr, "  -h\t\tdisplay this help output\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct pc_file base = { 0 }, new = { 0 };
+	struct pc_rec *rec;
+	int op, i, regressed = 0;
+
+	while ((op = getopt(argc, argv, "m:p:s:qh")) != -1) {
+		switch (op) {
+		case 'm':
+			if (metric_cnt == PC_MAX_METRICS) {
+				fprintf(stderr, "at most %d metrics\n",
+					PC_MAX_METRICS);
+				return 2;
+			}
+			metrics[metric_cnt++] = pc_norm_name(optarg);
+			break;
+		case 'p':
+			max_pct = atof(optarg);
+			break;
+		case 's':
+			max_sd = atof(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - 2 || max_pct < 0 || max_sd < 0) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (!metric_cnt) {
+		metrics[metric_cnt++] = "usec_per_xfer";
+		metrics[metric_cnt++] = "gbps";
+	}
+
+	base.name = argv[optind];
+	new.name = argv[optind + 1];
+	if (pc_load(&base) || pc_load(&new))
+		return 2;
+
+	for (i = 0; i < base.cnt; i++) {
+		rec = pc_find(&new, base.rec[i].key);
+		if (!rec) {
+			printf("%-48s missing from %s\n", base.rec[i].key,
+				new.name);
+			regressed = 1;
+			continue;
+		}
+		rec->matched = 1;
+		regressed |= pc_compare(&base.rec[i], rec);
+	}
+
+	for (i = 0; i < new.cnt; i++) {
+		if (!new.rec[i].matched && !quiet)
+			printf("%-48s new in %s\n", new.rec[i].key, new.name);
+	}
+
+	return regressed;
+}
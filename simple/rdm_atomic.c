@@ -62,7 +62,7 @@ struct addr_key {
 static struct cs_opts opts;
 static enum fi_op op_type = FI_MIN;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
 static void *buf;
 static void *result;
 static void *compare;
@@ -150,6 +150,9 @@ static int sync_test(void)
 {
 	int ret;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_msg(16) : post_recv();
 	if (ret)
 		return ret;
@@ -248,65 +251,73 @@ static int execute_compare_atomic_op(enum fi_op op)
 	return ret;
 }
 
-static int run_op(void)
+static int base_valid, fetch_valid, compare_valid;
+
+static int atomic_ops(int iters)
 {
 	int ret, i;
 
+	for (i = 0; i < iters; i++) {
+		if (base_valid) {
+			ret = execute_base_atomic_op(op_type);
+			if (ret)
+				return ret;
+		}
+		if (fetch_valid) {
+			ret = execute_fetch_atomic_op(op_type);
+			if (ret)
+				return ret;
+		}
+		if (compare_valid) {
+			ret = execute_compare_atomic_op(op_type);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int run_op(void)
+{
+	int ret, xfers;
+
 	count = (size_t *) malloc(sizeof(size_t));
-	sync_test();
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	
+	base_valid = fetch_valid = compare_valid = 0;
+
 	switch (op_type) {
 	case FI_MIN:
 	case FI_MAX:
 	case FI_ATOMIC_READ:
 	case FI_ATOMIC_WRITE:
-		ret = is_valid_base_atomic_op(op_type);
-		if (ret > 0) {
-			for (i = 0; i < opts.iterations; i++) {
-				ret = execute_base_atomic_op(op_type);
-				if (ret)
-					break;
-			}
-		}
-
-		ret = is_valid_fetch_atomic_op(op_type);
-		if (ret > 0) {
-			for (i = 0; i < opts.iterations; i++) {
-				ret = execute_fetch_atomic_op(op_type);
-				if (ret)
-					break;
-			}
-		}
+		base_valid = is_valid_base_atomic_op(op_type);
+		fetch_valid = is_valid_fetch_atomic_op(op_type);
 		break;
 	case FI_CSWAP:
-		ret = is_valid_compare_atomic_op(op_type);
-		if (ret > 0) {
-			for (i = 0; i < opts.iterations; i++) {
-				ret = execute_compare_atomic_op(op_type);
-				if(ret)
-					break;
-			}	
-		}
+		compare_valid = is_valid_compare_atomic_op(op_type);
 		break;
 	default:
 		ret = -EINVAL;
 		goto out;
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &end);
-	
+	xfers = base_valid + fetch_valid + compare_valid;
+	if (!xfers) {
+		ret = 0;
+		goto out;
+	}
+
+	ret = sync_test();
+	if (ret)
+		goto out;
+
+	ret = ft_run_trials(&opts, atomic_ops, NULL, NULL, &trials);
 	if (ret)
 		goto out;
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end,
-				op_type == FI_CSWAP ? 1 : 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, 
-				&start, &end, op_type == FI_CSWAP ? 1 : 2);
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, xfers, NULL,
+			&trials);
 
-	ret = 0;
 out:
 	free(count);
 	return ret;
@@ -357,9 +368,9 @@ static void free_ep_res(void)
 	fi_close(&mr_compare->fid);
 	fi_close(&rcq->fid);
 	fi_close(&scq->fid);
-	free(buf);
-	free(result);
-	free(compare);
+	ft_free_buf(buf);
+	ft_free_buf(result);
+	ft_free_buf(compare);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -368,21 +379,20 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	buf = malloc(MAX(buffer_size, sizeof(uint64_t)));
+	buffer_size = ft_max_size(&opts);
+	buf = ft_alloc_buf(&opts, MAX(buffer_size, sizeof(uint64_t)));
 	if (!buf) {
 		perror("malloc");
 		return -1;
 	}
 
-	result = malloc(MAX(buffer_size, sizeof(uint64_t)));
+	result = ft_alloc_buf(&opts, MAX(buffer_size, sizeof(uint64_t)));
 	if (!result) {
 		perror("malloc");
 		return -1;
 	}
 	
-	compare = malloc(MAX(buffer_size, sizeof(uint64_t)));
+	compare = ft_alloc_buf(&opts, MAX(buffer_size, sizeof(uint64_t)));
 	if (!compare) {
 		perror("malloc");
 		return -1;
@@ -390,15 +400,19 @@ static int alloc_ep_res(struct fi_info *fi)
 	
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = 128;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
@@ -406,8 +420,10 @@ static int alloc_ep_res(struct fi_info *fi)
 	
 	// registers local data buffer buff that specifies 
 	// the first operand of the atomic operation
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, MAX(buffer_size, sizeof(uint64_t)), 
 		FI_REMOTE_READ | FI_REMOTE_WRITE, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -415,16 +431,20 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	// registers local data buffer that stores initial value of 
 	// the remote buffer
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, result, MAX(buffer_size, sizeof(uint64_t)), 
 		FI_REMOTE_READ | FI_REMOTE_WRITE, 0, 0, 0, &mr_result, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", -ret);
 		goto err4;
 	}
 	
 	// registers local data buffer that contains comparison data
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, compare, MAX(buffer_size, sizeof(uint64_t)), 
 		FI_REMOTE_READ | FI_REMOTE_WRITE, 0, 0, 0, &mr_compare, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err5;
@@ -436,7 +456,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	av_attr.count = 1;
 	av_attr.name = NULL;
 
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err6;
@@ -455,9 +477,9 @@ err3:
 err2:
 	fi_close(&scq->fid);
 err1:
-	free(buf);
-	free(result);
-	free(compare);
+	ft_free_buf(buf);
+	ft_free_buf(result);
+	ft_free_buf(compare);
 	
 	return ret;
 }
@@ -484,7 +506,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if(ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -518,7 +542,9 @@ static int init_fabric(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
@@ -536,19 +562,25 @@ static int init_fabric(void)
 		memcpy(remote_addr, fi->dest_addr, addrlen);
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err2;
@@ -580,7 +612,11 @@ static int init_av(void)
 {
 	int ret;
 
-	if (opts.dst_addr) {
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, &fi_ctx_av);
+		if (ret)
+			return ret;
+	} else if (opts.dst_addr) {
 		// get local address blob. Find the addrlen first. We set 
 		// addrlen as 0 and fi_getname will return the actual addrlen
 		addrlen = 0;
@@ -597,8 +633,10 @@ static int init_av(void)
 			return ret;
 		}
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -625,8 +663,10 @@ static int init_av(void)
 		remote_addr = malloc(addrlen);
 		memcpy(remote_addr, buf + sizeof(size_t), addrlen);
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -649,6 +689,9 @@ static int exchange_addr_key(void)
 	local.addr = (uintptr_t) buf;
 	local.key = fi_mr_key(mr);
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_exchange(&local, &remote, sizeof local);
+
 	if (opts.dst_addr) {
 		*(struct addr_key *)buf = local;
 		ret = send_msg(len);
@@ -678,6 +721,10 @@ static int run(void)
 {
 	int i, ret = 0;
 	
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	ret = init_fabric();
 	if (ret)
 			return ret;
@@ -690,17 +737,8 @@ static int run(void)
 	if (ret)
 		goto out;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -714,6 +752,7 @@ out:
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
 	
+	ft_oob_fini();
 	return ret;
 }
 
@@ -764,7 +803,10 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
 	fi_freeinfo(fi);
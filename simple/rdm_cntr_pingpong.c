@@ -49,7 +49,8 @@ static int credits = 128;
 static int send_count = 0;
 static int recv_outs = 0;	/* Outstanding recvs */
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
+static struct ft_hist hist;
 static void *buf;
 static size_t buffer_size;
 
@@ -93,9 +94,11 @@ static int send_xfer(int size)
 			FT_PRINTERR("fi_cntr_wait", ret);
 			return ret;
 		}
+		ft_trace(FT_TRACE_COMP, FT_TRACE_TX, 1);
 	}
 
 	credits--;
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), remote_fi_addr, 
 			&fi_ctx_send);
 	if (ret) {
@@ -116,7 +119,9 @@ static int recv_xfer(int size)
 		FT_PRINTERR("fi_cntr_wait", ret);
 		return ret;
 	}
+	ft_trace(FT_TRACE_COMP, FT_TRACE_RX, 1);
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), remote_fi_addr, 
 			&fi_ctx_recv);
 	if (ret)
@@ -174,6 +179,9 @@ static int sync_test(void)
 	if (ret)
 		return ret;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret)
 		return ret;
@@ -181,37 +189,83 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
-static int run_test(void)
+/* Client tells the server how many iterations the next batch runs. */
+static int sync_iters(int *iters)
 {
-	int ret, i;
+	int ret;
 
-	ret = sync_test();
+	if (opts.dst_addr) {
+		*(int *) buf = *iters;
+		ret = send_xfer(sizeof *iters);
+		if (ret)
+			return ret;
+
+		return recv_xfer(sizeof *iters);
+	}
+
+	ret = recv_xfer(sizeof *iters);
 	if (ret)
-		goto out;
+		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
-		ret = opts.dst_addr ? send_xfer(opts.transfer_size) :
-				 recv_xfer(opts.transfer_size);
-		if (ret)
-			goto out;
+	*iters = *(int *) buf;
+	return send_xfer(sizeof *iters);
+}
+
+static int pingpong(int iters)
+{
+	uint64_t lap;
+	int ret, i;
+
+	lap = ft_timer_ticks();
+	for (i = 0; i < iters; i++) {
+		if (opts.dst_addr) {
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
 
-		ret = opts.dst_addr ? recv_xfer(opts.transfer_size) :
-				 send_xfer(opts.transfer_size);
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+		} else {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+		}
 		if (ret)
-			goto out;
+			return ret;
+
+		ft_hist_lap(&hist, &lap);
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, &start, &end, 2);
+	return 0;
+}
+
+static int run_test(void)
+{
+	int ret;
 
-	ret = 0;
+	ret = sync_test();
+	if (ret)
+		return ret;
 
-out:
-	return ret;
+	ret = ft_run_trials(&opts, pingpong, sync_iters, &hist, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 2, &hist,
+			&trials);
+
+	return 0;
 }
 
 static void free_ep_res(void)
@@ -220,7 +274,7 @@ static void free_ep_res(void)
 	fi_close(&mr->fid);
 	fi_close(&rcntr->fid);
 	fi_close(&scntr->fid);
-	free(buf);
+	ft_free_buf(buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -229,9 +283,8 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	buf = malloc(buffer_size);
+	buffer_size = ft_max_size(&opts);
+	buf = ft_alloc_buf(&opts, buffer_size);
 	if (!buf) {
 		perror("malloc");
 		return -1;
@@ -240,19 +293,25 @@ static int alloc_ep_res(struct fi_info *fi)
 	memset(&cntr_attr, 0, sizeof cntr_attr);
 	cntr_attr.events = FI_CNTR_EVENTS_COMP;
 
+	ft_setup_start(FT_SETUP_CNTR);
 	ret = fi_cntr_open(dom, &cntr_attr, &scntr, NULL);
+	ft_setup_end(FT_SETUP_CNTR);
 	if (ret) {
 		FT_PRINTERR("fi_cntr_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CNTR);
 	ret = fi_cntr_open(dom, &cntr_attr, &rcntr, NULL);
+	ft_setup_end(FT_SETUP_CNTR);
 	if (ret) {
 		FT_PRINTERR("fi_cntr_open", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -264,7 +323,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	av_attr.count = 1;
 	av_attr.name = NULL;
 
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err4;
@@ -279,7 +340,7 @@ err3:
 err2:
 	fi_close(&scntr->fid);
 err1:
-	free(buf);
+	ft_free_buf(buf);
 	return ret;
 }
 
@@ -305,7 +366,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -332,7 +395,9 @@ static int init_fabric(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
@@ -350,19 +415,25 @@ static int init_fabric(void)
 		memcpy(remote_addr, fi->dest_addr, addrlen);
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err2;
@@ -394,7 +465,11 @@ static int init_av(void)
 {
 	int ret;
 
-	if (opts.dst_addr) {
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, &fi_ctx_av);
+		if (ret)
+			return ret;
+	} else if (opts.dst_addr) {
 		/* Get local address blob. Find the addrlen first. We set addrlen 
 		 * as 0 and fi_getname will return the actual addrlen. */
 		addrlen = 0;
@@ -411,8 +486,10 @@ static int init_av(void)
 			return ret;
 		}
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -440,8 +517,10 @@ static int init_av(void)
 		remote_addr = malloc(addrlen);
 		memcpy(remote_addr, buf + sizeof(size_t), addrlen);
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -467,6 +546,10 @@ static int run(void)
 {
 	int i, ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	ret = init_fabric();
 	if (ret)
 		return ret;
@@ -475,17 +558,8 @@ static int run(void)
 	if (ret)
 		goto out;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -499,6 +573,7 @@ out:
 	free_ep_res();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -535,7 +610,10 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
 	fi_freeinfo(fi);
@@ -46,7 +46,8 @@ static struct cs_opts opts;
 static int max_inject_size;
 static int max_credits = 128;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
+static struct ft_hist hist;
 static void *send_buf, *recv_buf;
 static size_t buffer_size;
 
@@ -70,6 +71,7 @@ static int send_xfer(int size)
 {
 	int ret;
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_inject(ep, send_buf, (size_t) size, remote_fi_addr);
 	if (ret)
 		FT_PRINTERR("fi_inject", ret);
@@ -82,18 +84,11 @@ static int recv_xfer(int size)
 	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(rcq, "rcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, recv_buf, buffer_size, fi_mr_desc(mr), remote_fi_addr,
 			&fi_ctx_recv);
 	if (ret)
@@ -134,6 +129,9 @@ static int sync_test(void)
 {
 	int ret;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret)
 		return ret;
@@ -141,40 +139,86 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
-static int run_test(void)
+/* Client tells the server how many iterations the next batch runs. */
+static int sync_iters(int *iters)
 {
-	int ret, i;
+	int ret;
 
-	if (opts.transfer_size > max_inject_size) 
-		return 0;
+	if (opts.dst_addr) {
+		*(int *) send_buf = *iters;
+		ret = send_xfer(sizeof *iters);
+		if (ret)
+			return ret;
 
-	ret = sync_test();
+		return recv_xfer(sizeof *iters);
+	}
+
+	ret = recv_xfer(sizeof *iters);
 	if (ret)
-		goto out;
+		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
-		ret = opts.dst_addr ? send_xfer(opts.transfer_size) :
-				 recv_xfer(opts.transfer_size);
-		if (ret)
-			goto out;
+	*iters = *(int *) recv_buf;
+	return send_xfer(sizeof *iters);
+}
+
+static int pingpong(int iters)
+{
+	uint64_t lap;
+	int ret, i;
+
+	lap = ft_timer_ticks();
+	for (i = 0; i < iters; i++) {
+		if (opts.dst_addr) {
+			ft_verify_fill(&opts, send_buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, recv_buf, opts.transfer_size);
+		} else {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, recv_buf, opts.transfer_size);
+			if (ret)
+				return ret;
 
-		ret = opts.dst_addr ? recv_xfer(opts.transfer_size) :
-				 send_xfer(opts.transfer_size);
+			ft_verify_fill(&opts, send_buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+		}
 		if (ret)
-			goto out;
+			return ret;
+
+		ft_hist_lap(&hist, &lap);
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, &start, &end, 2);
+	return 0;
+}
+
+static int run_test(void)
+{
+	int ret;
 
-	ret = 0;
+	if (opts.transfer_size > max_inject_size) 
+		return 0;
 
-out:
-	return ret;
+	ret = sync_test();
+	if (ret)
+		return ret;
+
+	ret = ft_run_trials(&opts, pingpong, sync_iters, &hist, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 2, &hist,
+			&trials);
+
+	return 0;
 }
 
 static void free_ep_res(void)
@@ -183,8 +227,8 @@ static void free_ep_res(void)
 	fi_close(&mr->fid);
 	fi_close(&rcq->fid);
 	fi_close(&scq->fid);
-	free(send_buf);
-	free(recv_buf);
+	ft_free_buf(send_buf);
+	ft_free_buf(recv_buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -193,10 +237,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	send_buf = malloc(buffer_size);
-	recv_buf = malloc(buffer_size);
+	buffer_size = ft_max_size(&opts);
+	send_buf = ft_alloc_buf(&opts, buffer_size);
+	recv_buf = ft_alloc_buf(&opts, buffer_size);
 	if (!send_buf || !recv_buf) {
 		perror("malloc");
 		return -1;
@@ -204,16 +247,20 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
@@ -221,7 +268,9 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	/* Memory registration not required for send_buf since we use fi_inject.
 	 * fi_inject copies the buffer of data that needs to be sent. */
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, recv_buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err3;
@@ -233,7 +282,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	av_attr.count = 1;
 	av_attr.name = NULL;
 
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err4;
@@ -248,8 +299,8 @@ err3:
 err2:
 	fi_close(&rcq->fid);
 err1:
-	free(send_buf);
-	free(recv_buf);
+	ft_free_buf(send_buf);
+	ft_free_buf(recv_buf);
 	return ret;
 }
 
@@ -275,7 +326,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -302,7 +355,9 @@ static int init_fabric(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
@@ -329,19 +384,25 @@ static int init_fabric(void)
 		memcpy(remote_addr, fi->dest_addr, addrlen);
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err2;
@@ -373,7 +434,11 @@ static int init_av(void)
 {
 	int ret;
 
-	if (opts.dst_addr) {
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, &fi_ctx_av);
+		if (ret)
+			return ret;
+	} else if (opts.dst_addr) {
 		/* Get local address blob. Find the addrlen first. We set addrlen 
 		 * as 0 and fi_getname will return the actual addrlen. */
 		addrlen = 0;
@@ -390,8 +455,10 @@ static int init_av(void)
 			return ret;
 		}
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -419,8 +486,10 @@ static int init_av(void)
 		remote_addr = malloc(addrlen);
 		memcpy(remote_addr, recv_buf + sizeof(size_t), addrlen);
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -445,6 +514,10 @@ static int run(void)
 {
 	int i, ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	ret = init_fabric();
 	if (ret)
 		return ret;
@@ -453,17 +526,8 @@ static int run(void)
 	if (ret)
 		goto out;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -477,6 +541,7 @@ out:
 	free_ep_res();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -521,7 +586,10 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 
 	fi_freeinfo(hints);
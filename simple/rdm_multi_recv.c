@@ -53,7 +53,7 @@
 static struct cs_opts opts;
 static int max_credits = 128;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
 static void *send_buf, *multi_recv_buf;
 static size_t max_send_buf_size, multi_buf_size;
 
@@ -84,20 +84,13 @@ enum data_type {
 
 int wait_for_send_completion(int num_completions)
 {
-	int ret;
-	struct fi_cq_data_entry comp = {0};
-	
-	while (num_completions > 0) {
-	 	memset(&comp, 0, sizeof(comp));
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			num_completions--;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
-			FT_PRINTERR("fi_cq_read", ret);
-			return ret;
-		}
-	}
-	return 0;
+	return ft_cq_wait(scq, sizeof(struct fi_cq_data_entry),
+			  num_completions, NULL, NULL);
+}
+
+static void save_comp(void *comp, void *arg)
+{
+	memcpy(arg, comp, sizeof(struct fi_cq_data_entry));
 }
 
 int wait_for_recv_completion(void **recv_data, enum data_type type, 
@@ -110,7 +103,7 @@ int wait_for_recv_completion(void **recv_data, enum data_type type,
 
 	while (num_completions > 0) {
 	 	memset(&comp, 0, sizeof(comp));
-		ret = fi_cq_read(rcq, &comp, 1);
+		ret = ft_cq_get(rcq, sizeof comp, 1, save_comp, &comp);
 		if (ret > 0) {
  			header = (struct fi_ctx_multi_recv *)comp.op_context;
 			buf_index = header->index;
@@ -163,6 +156,10 @@ static int send_msg(int size)
 static int sync_test(void)
 {
 	int ret;
+
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_msg(SYNC_DATA_SIZE) :
 	   	wait_for_recv_completion(NULL, CONTROL, 1);
 	if (ret)
@@ -197,12 +194,12 @@ static int post_multi_recv_buffer()
 	return ret;
 }
 
-static int send_multi_recv_msg()
+static int send_multi_recv_msg(int iters)
 {
 	int ret, i;
 	ret = 0;
 	// send multi_recv data based on the transfer size
-	for(i = 0; i < opts.iterations; i++) {
+	for(i = 0; i < iters; i++) {
 		ctx_send = (struct fi_ctx_multi_recv *) 
 			malloc(sizeof(struct fi_ctx_multi_recv));
 		ret = fi_send(ep, send_buf, (size_t) opts.transfer_size, 
@@ -217,46 +214,40 @@ static int send_multi_recv_msg()
 	return ret;
 }
 
-static int run_test(void)
+static int multi_recv(int iters)
 {
 	int ret;
-	
-	ret = sync_test();
-	if (ret) {
-		fprintf(stderr, "sync_test failed!\n");
-		goto out;
-	}
-	
-	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	if(opts.dst_addr) {
-		ret = send_multi_recv_msg();
-		if(ret){
+		ret = send_multi_recv_msg(iters);
+		if(ret)
 		  fprintf(stderr, "send_multi_recv_msg failed!\n");
-			goto out;
-		}
 	} else {
 		// wait for all the receive completion events for 
 		// multi_recv transfer
-		ret = wait_for_recv_completion(NULL, CONTROL, opts.iterations);
-		if(ret){
+		ret = wait_for_recv_completion(NULL, CONTROL, iters);
+		if(ret)
 		  fprintf(stderr, "wait_for_recv_completion failed\n");
-			goto out;			
-		}
 	}
-	
-	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ret;
+}
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations,
-			&start, &end, 1, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations,
-			&start, &end, 1);
+static int run_test(void)
+{
+	int ret;
+	
+	ret = sync_test();
+	if (ret) {
+		fprintf(stderr, "sync_test failed!\n");
+		return ret;
+	}
 
-	ret = 0;
+	ret = ft_run_trials(&opts, multi_recv, NULL, NULL, &trials);
+	if (ret)
+		return ret;
 
-out:
-	return ret;
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 1, NULL, &trials);
+	return 0;
 }
 
 static void free_ep_res(void)
@@ -268,8 +259,8 @@ static void free_ep_res(void)
 	fi_close(&scq->fid);
 	free(ctx_send);
 	free(ctx_multi_recv);
-	free(send_buf);
-	free(multi_recv_buf);
+	ft_free_buf(send_buf);
+	ft_free_buf(multi_recv_buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -290,13 +281,15 @@ static int alloc_ep_res(struct fi_info *fi)
 		return -1;		
 	}
 
-	send_buf = malloc(max_send_buf_size);
+	send_buf = ft_alloc_buf(&opts, max_send_buf_size);
 	if (!send_buf) {
 		fprintf(stderr, "Cannot allocate send_buf\n");
 		return -1;
 	}
 	
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, send_buf, max_send_buf_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err1;
@@ -305,15 +298,17 @@ static int alloc_ep_res(struct fi_info *fi)
 	// set the multi buffer size to be allocated
 	multi_buf_size = MAX(max_send_buf_size, DEFAULT_MULTI_BUF_SIZE) * 
 		MULTI_BUF_SIZE_FACTOR;
-	multi_recv_buf = malloc(multi_buf_size);
+	multi_recv_buf = ft_alloc_buf(&opts, multi_buf_size);
 	if (!multi_recv_buf) {
 		fprintf(stderr, "Cannot allocate multi_recv_buf\n");
 		ret = -1;
 		goto err1;
 	}
 	
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, multi_recv_buf, multi_buf_size, 0, 0, 1, 0, 
 			&mr_multi_recv, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err2;
@@ -321,15 +316,19 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_DATA;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err3;
 	}
 	
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err4;
@@ -341,7 +340,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	av_attr.count = 1;
 	av_attr.name = NULL;
 
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err5;
@@ -355,10 +356,10 @@ err4:
 err3:
 	fi_close(&mr_multi_recv->fid);	
 err2:
-	free(multi_recv_buf);
+	ft_free_buf(multi_recv_buf);
 	fi_close(&mr->fid);
 err1:
-	free(send_buf);
+	ft_free_buf(send_buf);
 	
 	return ret;
 }
@@ -397,7 +398,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -424,7 +427,9 @@ static int init_fabric(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
@@ -440,19 +445,25 @@ static int init_fabric(void)
 	// set FI_MULTI_RECV flag for all recv operations
 	fi->rx_attr->op_flags = FI_MULTI_RECV;
 	
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err2;
@@ -495,7 +506,11 @@ static int init_av(void)
 	int ret;
 	void *recv_buf = NULL;
 	
-	if (opts.dst_addr) {
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, &fi_ctx_av);
+		if (ret)
+			return ret;
+	} else if (opts.dst_addr) {
 		// Get local address blob. Find the addrlen first. We set 
 		// addrlen as 0 and fi_getname will return the actual addrlen. 
 		addrlen = 0;
@@ -512,8 +527,10 @@ static int init_av(void)
 			return ret;
 		}
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -546,8 +563,10 @@ static int init_av(void)
 			return ret;
 		memcpy(remote_addr, recv_buf, addrlen);
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -562,6 +581,10 @@ static int run(void)
 {
 	int ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	ret = init_fabric();
 	if (ret)
 		goto out;
@@ -578,6 +601,7 @@ out:
 	free_ep_res();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -614,7 +638,10 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 
 	fi_freeinfo(hints);
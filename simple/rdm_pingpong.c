@@ -45,8 +45,9 @@
 static struct cs_opts opts;
 static int max_credits = 128;
 static int credits = 128;
-static char test_name[10] = "custom";
-static struct timespec start, end;
+static char test_name[32] = "custom";
+static struct ft_trials trials;
+static struct ft_hist hist;
 static void *buf;
 static size_t buffer_size;
 
@@ -71,10 +72,8 @@ static int send_xfer(int size)
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			goto post;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
+		ret = ft_cq_get(scq, sizeof comp, max_credits, NULL, NULL);
+		if (ret < 0) {
 			if (ret == -FI_EAVAIL) {
 				cq_readerr(scq, "scq");
 			} else {
@@ -82,10 +81,11 @@ static int send_xfer(int size)
 			}
 			return ret;
 		}
+		credits += ret;
 	}
 
 	credits--;
-post:
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_send(ep, buf, (size_t) size, fi_mr_desc(mr), remote_fi_addr,
 			&fi_ctx_send);
 	if (ret)
@@ -99,18 +99,11 @@ static int recv_xfer(int size)
 	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			if (ret == -FI_EAVAIL) {
-				cq_readerr(rcq, "rcq");
-			} else {
-				FT_PRINTERR("fi_cq_read", ret);
-			}
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), remote_fi_addr,
 			&fi_ctx_recv);
 	if (ret)
@@ -160,6 +153,9 @@ static int sync_test(void)
 	}
 	credits = max_credits;
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret)
 		return ret;
@@ -167,37 +163,164 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
+/* Client tells the server how many iterations the next batch runs. */
+static int sync_iters(int *iters)
+{
+	int ret;
+
+	if (opts.dst_addr) {
+		*(int *) buf = *iters;
+		ret = send_xfer(sizeof *iters);
+		if (ret)
+			return ret;
+
+		return recv_xfer(sizeof *iters);
+	}
+
+	ret = recv_xfer(sizeof *iters);
+	if (ret)
+		return ret;
+
+	*iters = *(int *) buf;
+	return send_xfer(sizeof *iters);
+}
+
+static int pingpong(int iters)
+{
+	uint64_t lap;
+	int ret, i;
+
+	lap = ft_timer_ticks();
+	for (i = 0; i < iters; i++) {
+		if (opts.dst_addr) {
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+		} else {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf, opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ft_verify_fill(&opts, buf, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+		}
+		if (ret)
+			return ret;
+
+		ft_hist_lap(&hist, &lap);
+	}
+
+	return 0;
+}
+
 static int run_test(void)
+{
+	int ret;
+
+	ret = sync_test();
+	if (ret)
+		return ret;
+
+	ret = ft_run_trials(&opts, pingpong, sync_iters, &hist, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 2, &hist,
+			&trials);
+
+	return 0;
+}
+
+static int load_send(void)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	if (!credits) {
+		ret = ft_cq_reap(scq, sizeof comp, max_credits, NULL, NULL);
+		if (ret < 0) {
+			if (ret == -FI_EAVAIL) {
+				cq_readerr(scq, "scq");
+			} else {
+				FT_PRINTERR("fi_cq_read", ret);
+			}
+			return ret;
+		}
+		credits += ret;
+		if (!credits)
+			return -FI_EAGAIN;
+	}
+
+	return send_xfer(opts.transfer_size);
+}
+
+static int load_poll(void)
+{
+	struct fi_cq_entry comp;
+	int ret;
+
+	ret = ft_cq_reap(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret <= 0) {
+		if (ret == -FI_EAVAIL) {
+			cq_readerr(rcq, "rcq");
+		} else if (ret) {
+			FT_PRINTERR("fi_cq_read", ret);
+		}
+		return ret;
+	}
+
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
+	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), remote_fi_addr,
+			&fi_ctx_recv);
+	if (ret) {
+		FT_PRINTERR("fi_recv", ret);
+		return ret;
+	}
+
+	return 1;
+}
+
+/* The client offers load at rate, the server echoes every message. */
+static int run_load_test(uint64_t rate)
 {
 	int ret, i;
 
 	ret = sync_test();
 	if (ret)
-		goto out;
+		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
-		ret = opts.dst_addr ? send_xfer(opts.transfer_size) :
-				 recv_xfer(opts.transfer_size);
-		if (ret)
-			goto out;
+	if (!opts.dst_addr) {
+		for (i = 0; i < opts.iterations; i++) {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
 
-		ret = opts.dst_addr ? recv_xfer(opts.transfer_size) :
-				 send_xfer(opts.transfer_size);
-		if (ret)
-			goto out;
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+		}
+		return 0;
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, &start, &end, 2);
+	ret = ft_run_load(&opts, rate, load_send, load_poll, &hist, &trials);
+	if (ret)
+		return ret;
 
-	ret = 0;
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 1, &hist,
+			&trials);
 
-out:
-	return ret;
+	return 0;
 }
 
 static void free_ep_res(void)
@@ -206,7 +329,7 @@ static void free_ep_res(void)
 	fi_close(&mr->fid);
 	fi_close(&rcq->fid);
 	fi_close(&scq->fid);
-	free(buf);
+	ft_free_buf(buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -215,9 +338,8 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
-	buf = malloc(buffer_size);
+	buffer_size = ft_max_size(&opts);
+	buf = ft_alloc_buf(&opts, buffer_size);
 	if (!buf) {
 		perror("malloc");
 		return -1;
@@ -225,21 +347,27 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -251,7 +379,9 @@ static int alloc_ep_res(struct fi_info *fi)
 	av_attr.count = 1;
 	av_attr.name = NULL;
 
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err4;
@@ -266,7 +396,7 @@ err3:
 err2:
 	fi_close(&scq->fid);
 err1:
-	free(buf);
+	ft_free_buf(buf);
 	return ret;
 }
 
@@ -292,7 +422,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -319,7 +451,9 @@ static int init_fabric(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		return ret;
@@ -337,19 +471,25 @@ static int init_fabric(void)
 		memcpy(remote_addr, fi->dest_addr, addrlen);
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err0;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err2;
@@ -381,7 +521,11 @@ static int init_av(void)
 {
 	int ret;
 
-	if (opts.dst_addr) {
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, &fi_ctx_av);
+		if (ret)
+			return ret;
+	} else if (opts.dst_addr) {
 		/* Get local address blob. Find the addrlen first. We set 
 		 * addrlen as 0 and fi_getname will return the actual addrlen. */
 		addrlen = 0;
@@ -398,8 +542,10 @@ static int init_av(void)
 			return ret;
 		}
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -427,8 +573,10 @@ static int init_av(void)
 		remote_addr = malloc(addrlen);
 		memcpy(remote_addr, buf + sizeof(size_t), addrlen);
 
+		ft_setup_start(FT_SETUP_AV_INSERT);
 		ret = fi_av_insert(av, remote_addr, 1, &remote_fi_addr, 0, 
 				&fi_ctx_av);
+		ft_setup_end(FT_SETUP_AV_INSERT);
 		if (ret != 1) {
 			FT_PRINTERR("fi_av_insert", ret);
 			return ret;
@@ -451,7 +599,12 @@ static int init_av(void)
 
 static int run(void)
 {
-	int i, ret = 0;
+	char sstr[FT_STR_LEN];
+	int i, j, ret = 0;
+
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
 
 	ret = init_fabric();
 	if (ret)
@@ -461,21 +614,24 @@ static int run(void)
 	if (ret)
 		goto out;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		opts.transfer_size = opts.sizes[i];
+		init_test(&opts, test_name, sizeof(test_name));
+		if (!opts.rate_cnt) {
 			ret = run_test();
 			if (ret)
 				goto out;
+			continue;
+		}
+
+		for (j = 0; j < opts.rate_cnt; j++) {
+			snprintf(test_name, sizeof test_name, "%s_load_%llu",
+				 size_str(sstr, opts.transfer_size),
+				 (unsigned long long) opts.rates[j]);
+			ret = run_load_test(opts.rates[j]);
+			if (ret)
+				goto out;
 		}
-	} else {
-		init_test(&opts, test_name, sizeof(test_name));
-		ret = run_test();
-		if (ret)
-			goto out;
 	}
 
 	wait_for_completion(scq, max_credits - credits);
@@ -486,6 +642,7 @@ out:
 	free_ep_res();
 	fi_close(&dom->fid);
 	fi_close(&fab->fid);
+	ft_oob_fini();
 	return ret;
 }
 
@@ -498,15 +655,25 @@ int main(int argc, char **argv)
 	if (!hints)
 		return EXIT_FAILURE;
 
-	while ((op = getopt(argc, argv, "h" CS_OPTS INFO_OPTS)) != -1) {
+	while ((op = getopt(argc, argv, "hL:" CS_OPTS INFO_OPTS)) != -1) {
 		switch (op) {
 		default:
 			ft_parseinfo(op, optarg, hints);
 			ft_parsecsopts(op, optarg, &opts);
 			break;
+		case 'L':
+			free(opts.rates);
+			if (ft_parse_rates(optarg, &opts.rates, &opts.rate_cnt)) {
+				fprintf(stderr, "invalid rate specification: %s\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case '?':
 		case 'h':
 			ft_csusage(argv[0], "Ping pong client and server using RDM.");
+			fprintf(stderr, "  -L <rates>\topen-loop load at comma separated message rates,\n"
+					"\t\te.g. 10k,100k,1m, reporting latency at each rate\n");
 			return EXIT_FAILURE;
 		}
 	}
@@ -522,9 +689,13 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(&hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
 	fi_freeinfo(fi);
+	free(opts.rates);
 	return ret;
 }
@@ -126,7 +126,7 @@ static int alloc_ep_res(void)
 	struct fi_av_attr av_attr;
 	int ret = 0;
 
-	buffer_size = test_size[TEST_CNT - 1].size;
+	buffer_size = FT_MAX_SIZE;
 	buf = malloc(buffer_size);
 
 	remote_fi_addr = (fi_addr_t *)malloc(sizeof(*remote_fi_addr) * ep_cnt);
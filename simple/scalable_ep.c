@@ -153,7 +153,7 @@ static int alloc_ep_res(struct fid_ep *sep)
 	struct fi_av_attr av_attr;
 	int i, ret;
 
-	buffer_size = test_size[TEST_CNT - 1].size;
+	buffer_size = FT_MAX_SIZE;
 	buf = malloc(buffer_size);
 
 	scq = calloc(ctx_cnt, sizeof *scq);
@@ -51,7 +51,8 @@ static struct cs_opts opts;
 static int max_credits = 128;
 static int credits = 128;
 static char test_name[10] = "custom";
-static struct timespec start, end;
+static struct ft_trials trials;
+static struct ft_hist hist;
 static void *buf;
 static void *buf_ptr;
 static size_t buffer_size;
@@ -74,15 +75,17 @@ static int poll_all_sends(void)
 	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			credits++;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
+	while (credits < max_credits) {
+		ret = ft_cq_reap(scq, sizeof comp, max_credits - credits,
+				 NULL, NULL);
+		if (ret < 0) {
 			FT_PRINTERR("fi_cq_read", ret);
 			return ret;
+		} else if (!ret) {
+			break;
 		}
-	} while (ret != -FI_EAGAIN);
+		credits += ret;
+	}
 	return 0;
 }
 
@@ -92,17 +95,16 @@ static int send_xfer(int size)
 	int ret;
 
 	while (!credits) {
-		ret = fi_cq_read(scq, &comp, 1);
-		if (ret > 0) {
-			goto post;
-		} else if (ret < 0 && ret != -FI_EAGAIN) {
+		ret = ft_cq_get(scq, sizeof comp, max_credits, NULL, NULL);
+		if (ret < 0) {
 			FT_PRINTERR("fi_cq_read", ret);
 			return ret;
 		}
+		credits += ret;
 	}
 
 	credits--;
-post:
+	ft_trace(FT_TRACE_POST, FT_TRACE_TX, size);
 	ret = fi_send(ep, buf_ptr, (size_t) size, fi_mr_desc(mr),
 			remote_fi_addr, NULL);
 	if (ret)
@@ -116,14 +118,11 @@ static int recv_xfer(int size)
 	struct fi_cq_entry comp;
 	int ret;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, sizeof comp);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			FT_PRINTERR("fi_cq_read", ret);
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
+	ft_trace(FT_TRACE_POST, FT_TRACE_RX, buffer_size);
 	ret = fi_recv(ep, buf, buffer_size, fi_mr_desc(mr), 0, buf);
 	if (ret)
 		FT_PRINTERR("fi_recv", ret);
@@ -138,6 +137,9 @@ static int sync_test(void)
 	while (credits < max_credits)
 		poll_all_sends();
 
+	if (ft_oob_sock >= 0)
+		return ft_oob_barrier();
+
 	ret = opts.dst_addr ? send_xfer(16) : recv_xfer(16);
 	if (ret)
 		return ret;
@@ -145,32 +147,81 @@ static int sync_test(void)
 	return opts.dst_addr ? recv_xfer(16) : send_xfer(16);
 }
 
-static int run_test(void)
+/* Client tells the server how many iterations the next batch runs. */
+static int sync_iters(int *iters)
 {
-	int ret, i;
+	int ret;
 
-	ret = sync_test();
+	if (opts.dst_addr) {
+		*(int *) buf_ptr = *iters;
+		ret = send_xfer(sizeof *iters);
+		if (ret)
+			return ret;
+
+		return recv_xfer(sizeof *iters);
+	}
+
+	ret = recv_xfer(sizeof *iters);
 	if (ret)
 		return ret;
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	for (i = 0; i < opts.iterations; i++) {
-		ret = opts.dst_addr ? send_xfer(opts.transfer_size) :
-				 recv_xfer(opts.transfer_size);
-		if (ret)
-			return ret;
+	*iters = *(int *) buf_ptr;
+	return send_xfer(sizeof *iters);
+}
+
+static int pingpong(int iters)
+{
+	uint64_t lap;
+	int ret, i;
+
+	lap = ft_timer_ticks();
+	for (i = 0; i < iters; i++) {
+		if (opts.dst_addr) {
+			ft_verify_fill(&opts, buf_ptr, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf_ptr, opts.transfer_size);
+		} else {
+			ret = recv_xfer(opts.transfer_size);
+			if (ret)
+				return ret;
+
+			ret = ft_verify_check(&opts, buf_ptr, opts.transfer_size);
+			if (ret)
+				return ret;
 
-		ret = opts.dst_addr ? recv_xfer(opts.transfer_size) :
-				 send_xfer(opts.transfer_size);
+			ft_verify_fill(&opts, buf_ptr, opts.transfer_size);
+			ret = send_xfer(opts.transfer_size);
+		}
 		if (ret)
 			return ret;
+
+		ft_hist_lap(&hist, &lap);
 	}
-	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	if (opts.machr)
-		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end, 2, opts.argc, opts.argv);
-	else
-		show_perf(test_name, opts.transfer_size, opts.iterations, &start, &end, 2);
+	return 0;
+}
+
+static int run_test(void)
+{
+	int ret;
+
+	ret = sync_test();
+	if (ret)
+		return ret;
+
+	ret = ft_run_trials(&opts, pingpong, sync_iters, &hist, &trials);
+	if (ret)
+		return ret;
+
+	ft_show_perf(&opts, fi, test_name, opts.transfer_size, 2, &hist,
+			&trials);
 
 	return 0;
 }
@@ -197,7 +248,7 @@ static void free_ep_res(void)
 			FT_PRINTERR("fi_close", ret);
 		}
 	}
-	free(buf);
+	ft_free_buf(buf);
 }
 
 static int alloc_ep_res(struct fi_info *fi)
@@ -206,8 +257,7 @@ static int alloc_ep_res(struct fi_info *fi)
 	struct fi_av_attr av_attr;
 	int ret;
 
-	buffer_size = opts.user_options & FT_OPT_SIZE ?
-			opts.transfer_size : test_size[TEST_CNT - 1].size;
+	buffer_size = ft_max_size(&opts);
 	if (max_msg_size > 0 && buffer_size > max_msg_size) {
 		buffer_size = max_msg_size;
 	}
@@ -215,7 +265,7 @@ static int alloc_ep_res(struct fi_info *fi)
 		buffer_size = fi->src_addrlen;
 	}
 	buffer_size += prefix_len;
-	buf = malloc(buffer_size);
+	buf = ft_alloc_buf(&opts, buffer_size);
 	if (!buf) {
 		perror("malloc");
 		return -1;
@@ -224,21 +274,27 @@ static int alloc_ep_res(struct fi_info *fi)
 
 	memset(&cq_attr, 0, sizeof cq_attr);
 	cq_attr.format = FI_CQ_FORMAT_CONTEXT;
-	cq_attr.wait_obj = FI_WAIT_NONE;
+	cq_attr.wait_obj = ft_cq_wait_obj();
 	cq_attr.size = max_credits << 1;
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &scq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err1;
 	}
 
+	ft_setup_start(FT_SETUP_CQ);
 	ret = fi_cq_open(dom, &cq_attr, &rcq, NULL);
+	ft_setup_end(FT_SETUP_CQ);
 	if (ret) {
 		FT_PRINTERR("fi_cq_open", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_MR);
 	ret = fi_mr_reg(dom, buf, buffer_size, 0, 0, 0, 0, &mr, NULL);
+	ft_setup_end(FT_SETUP_MR);
 	if (ret) {
 		FT_PRINTERR("fi_mr_reg", ret);
 		goto err3;
@@ -249,7 +305,9 @@ static int alloc_ep_res(struct fi_info *fi)
 			fi->domain_attr->av_type : FI_AV_MAP;
 	av_attr.name = NULL;
 	av_attr.flags = 0;
+	ft_setup_start(FT_SETUP_AV);
 	ret = fi_av_open(dom, &av_attr, &av, NULL);
+	ft_setup_end(FT_SETUP_AV);
 	if (ret) {
 		FT_PRINTERR("fi_av_open", ret);
 		goto err4;
@@ -264,7 +322,7 @@ err3:
 err2:
 	fi_close(&scq->fid);
 err1:
-	free(buf);
+	ft_free_buf(buf);
 	return ret;
 }
 
@@ -290,7 +348,9 @@ static int bind_ep_res(void)
 		return ret;
 	}
 
+	ft_setup_start(FT_SETUP_ENABLE);
 	ret = fi_enable(ep);
+	ft_setup_end(FT_SETUP_ENABLE);
 	if (ret) {
 		FT_PRINTERR("fi_enable", ret);
 		return ret;
@@ -324,7 +384,9 @@ static int common_setup(void)
 		flags = FI_SOURCE;
 	}
 
+	ft_setup_start(FT_SETUP_GETINFO);
 	ret = fi_getinfo(FT_FIVERSION, node, service, flags, hints, &fi);
+	ft_setup_end(FT_SETUP_GETINFO);
 	if (ret) {
 		FT_PRINTERR("fi_getinfo", ret);
 		goto err1;
@@ -333,7 +395,9 @@ static int common_setup(void)
 		max_msg_size = fi->ep_attr->max_msg_size;
 	}
 
+	ft_setup_start(FT_SETUP_FABRIC);
 	ret = fi_fabric(fi->fabric_attr, &fab, NULL);
+	ft_setup_end(FT_SETUP_FABRIC);
 	if (ret) {
 		FT_PRINTERR("fi_fabric", ret);
 		goto err1;
@@ -342,13 +406,17 @@ static int common_setup(void)
 		prefix_len = fi->ep_attr->msg_prefix_size;
 	}
 
+	ft_setup_start(FT_SETUP_DOMAIN);
 	ret = fi_domain(fab, fi, &dom, NULL);
+	ft_setup_end(FT_SETUP_DOMAIN);
 	if (ret) {
 		FT_PRINTERR("fi_domain", ret);
 		goto err2;
 	}
 
+	ft_setup_start(FT_SETUP_ENDPOINT);
 	ret = fi_endpoint(dom, fi, &ep, NULL);
+	ft_setup_end(FT_SETUP_ENDPOINT);
 	if (ret) {
 		FT_PRINTERR("fi_endpoint", ret);
 		goto err3;
@@ -390,11 +458,20 @@ static int client_connect(void)
 	if (ret != 0)
 		goto err;
 
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, NULL);
+		if (ret)
+			goto err;
+		return 0;
+	}
+
 	ret = ft_getdestaddr(opts.dst_addr, opts.dst_port, hints);
 	if (ret != 0)
 		goto err;
 
+	ft_setup_start(FT_SETUP_AV_INSERT);
 	ret = fi_av_insert(av, hints->dest_addr, 1, &remote_fi_addr, 0, NULL);
+	ft_setup_end(FT_SETUP_AV_INSERT);
 	if (ret != 1) {
 		FT_PRINTERR("fi_av_insert", ret);
 		goto err;
@@ -439,15 +516,20 @@ static int server_connect(void)
 	if (ret != 0)
 		goto err;
 
-	do {
-		ret = fi_cq_read(rcq, &comp, 1);
-		if (ret < 0 && ret != -FI_EAGAIN) {
-			FT_PRINTERR("fi_cq_read", ret);
-			return ret;
-		}
-	} while (ret == -FI_EAGAIN);
+	if (ft_oob_sock >= 0) {
+		ret = ft_oob_av_insert(ep, av, &remote_fi_addr, NULL);
+		if (ret)
+			goto err;
+		return 0;
+	}
+
+	ret = ft_cq_wait(rcq, sizeof comp, 1, NULL, NULL);
+	if (ret)
+		return ret;
 
+	ft_setup_start(FT_SETUP_AV_INSERT);
 	ret = fi_av_insert(av, buf_ptr, 1, &remote_fi_addr, 0, NULL);
+	ft_setup_end(FT_SETUP_AV_INSERT);
 	if (ret != 1) {
 		if (ret == 0) {
 			fprintf(stderr, "Unable to resolve remote address 0x%x 0x%x\n",
@@ -483,21 +565,19 @@ static int run(void)
 {
 	int i, ret = 0;
 
+	ret = ft_oob_init(&opts);
+	if (ret)
+		return ret;
+
 	ret = opts.dst_addr ? client_connect() : server_connect();
 	if (ret)
 		return ret;
 
-	if (!(opts.user_options & FT_OPT_SIZE)) {
-		for (i = 0; i < TEST_CNT; i++) {
-			if (test_size[i].option > opts.size_option)
-				continue;
-			opts.transfer_size = test_size[i].size;
-			init_test(&opts, test_name, sizeof(test_name));
-			ret = run_test();
-			if (ret)
-				goto out;
-		}
-	} else {
+	for (i = 0; i < ft_size_cnt(&opts); i++) {
+		/* the buffer is only sized for what the provider can send */
+		if (max_msg_size && opts.sizes[i] > max_msg_size - prefix_len)
+			continue;
+		opts.transfer_size = opts.sizes[i];
 		init_test(&opts, test_name, sizeof(test_name));
 		ret = run_test();
 		if (ret)
@@ -527,6 +607,7 @@ out:
 		FT_PRINTERR("fi_close", ret);
 	}
 
+	ft_oob_fini();
 	return ret;
 }
 
@@ -564,7 +645,10 @@ int main(int argc, char **argv)
 		printf("%s", fi_tostr(hints, FI_TYPE_INFO));
 		ret = EXIT_SUCCESS;
 	} else {
-		ret = run();
+		ret = ft_pairs_fork(&opts);
+		if (!ret)
+			ret = run();
+		ret = ft_pairs_join(ret);
 	}
 	fi_freeinfo(hints);
 	fi_freeinfo(fi);